@@ -0,0 +1,35 @@
+#pragma once
+
+// Counts heap allocations by replacing the global operator new and delete. Only builds that define
+// CPPWIN32_COUNT_ALLOCATIONS, such as cppwin32_bench, pay for the count or give up the CRT's own
+// operator new. Include this header from one translation unit only, since the replacements are not inline.
+#ifdef CPPWIN32_COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace cppwin32
+{
+    inline std::atomic<uint64_t> allocations;
+}
+
+void* operator new(size_t const size)
+{
+    cppwin32::allocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (auto const result = std::malloc(size ? size : 1))
+    {
+        return result;
+    }
+
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* const pointer) noexcept
+{
+    std::free(pointer);
+}
+
+#endif
@@ -1,7 +1,8 @@
-#pragma once
-
-#ifndef WIN32_BASE_H
-#define WIN32_BASE_H
+// The macros come first and on their own, so that a module can take them without the declarations, which it
+// imports from the base partition instead (see -modules). Both parts have include guards rather than
+// #pragma once, because the base partition includes the file a second time for the declarations.
+#ifndef WIN32_BASE_MACROS
+#define WIN32_BASE_MACROS
 
 #include <array>
 #include <stddef.h>
@@ -51,6 +52,11 @@
 #define WIN32_IMPL_LINK(function, count) __pragma(comment(linker, "/alternatename:WIN32_IMPL_" #function "=" #function))
 #endif
 
+#endif
+
+#if !defined(WIN32_BASE_H) && !defined(WIN32_IMPL_MACROS_ONLY)
+#define WIN32_BASE_H
+
 WIN32_EXPORT namespace win32
 {
     struct hresult
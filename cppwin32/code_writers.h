@@ -58,26 +58,26 @@ namespace cppwin32
     static void write_version_assert(writer& w)
     {
         w.write_root_include("base");
-        auto format = R"(static_assert(win32::check_version(CPPWIN32_VERSION, "%"), "Mismatched C++/Win32 headers.");
+        static constexpr format_string format{ R"(static_assert(win32::check_version(CPPWIN32_VERSION, "%"), "Mismatched C++/Win32 headers.");
 #define CPPWIN32_VERSION "%"
-)";
-        w.write(format, CPPWIN32_VERSION_STRING, CPPWIN32_VERSION_STRING);
+)" };
+        w.write<format>(CPPWIN32_VERSION_STRING, CPPWIN32_VERSION_STRING);
     }
 
     void write_include_guard(writer& w)
     {
-        auto format = R"(#pragma once
-)";
+        static constexpr format_string format{ R"(#pragma once
+)" };
 
-        w.write(format);
+        w.write<format>();
     }
 
     static void write_endif(writer& w)
     {
-        auto format = R"(#endif
-)";
+        static constexpr format_string format{ R"(#endif
+)" };
 
-        w.write(format);
+        w.write<format>();
     }
 
     static void write_close_file_guard(writer& w)
@@ -101,11 +101,66 @@ namespace cppwin32
             mangled_name += impl;
         }
 
-        auto format = R"(#ifndef WIN32_%_H
+        static constexpr format_string format{ R"(#ifndef WIN32_%_H
 #define WIN32_%_H
-)";
+)" };
 
-        w.write(format, mangled_name, mangled_name);
+        w.write<format>(mangled_name, mangled_name);
+    }
+
+    static void write_close_module_guard(writer& w)
+    {
+        if (settings.modules)
+        {
+            write_endif(w);
+        }
+    }
+
+    // A module partition includes the header after importing the partitions of the headers that it would
+    // include, so the includes are skipped there.
+    [[nodiscard]] static finish_with wrap_module_guard(writer& w)
+    {
+        if (settings.modules)
+        {
+            static constexpr format_string format{ R"(#ifndef WIN32_MODULE
+)" };
+
+            w.write<format>();
+        }
+
+        return { w, write_close_module_guard };
+    }
+
+    static void write_partition_name(writer& w, std::string_view const& ns, char impl)
+    {
+        if (impl)
+        {
+            w.write("%.impl%", ns, impl);
+        }
+        else
+        {
+            w.write(ns);
+        }
+    }
+
+    // The macros of base.h are taken in the global module fragment, since a module cannot export them, and
+    // WIN32_EXPORT is then redefined so that the declarations included after it are exported.
+    static void write_module_prologue(writer& w, std::string_view const& partition)
+    {
+        w.write(R"(module;
+#define WIN32_IMPL_MACROS_ONLY
+)");
+        w.write_root_include("base");
+        w.write(R"(#undef WIN32_IMPL_MACROS_ONLY
+export module win32:%;
+)", partition);
+    }
+
+    static void write_module_export(writer& w)
+    {
+        w.write(R"(#undef WIN32_EXPORT
+#define WIN32_EXPORT export
+)");
     }
 
     template<typename... Args>
@@ -117,19 +172,19 @@ namespace cppwin32
 
     void write_close_namespace(writer& w)
     {
-        auto format = R"(}
-)";
+        static constexpr format_string format{ R"(}
+)" };
 
-        w.write(format);
+        w.write<format>();
     }
 
     [[nodiscard]] static finish_with wrap_impl_namespace(writer& w)
     {
-        auto format = R"(namespace win32::_impl_
+        static constexpr format_string format{ R"(namespace win32::_impl_
 {
-)";
+)" };
 
-        w.write(format);
+        w.write<format>();
 
         return { w, write_close_namespace };
     }
@@ -137,35 +192,36 @@ namespace cppwin32
     [[nodiscard]] finish_with wrap_type_namespace(writer& w, std::string_view const& ns)
     {
         // TODO: Move into forwards
-        auto format = R"(WIN32_EXPORT namespace win32::@
+        static constexpr format_string format{ R"(WIN32_EXPORT namespace win32::@
 {
-)";
+)" };
 
-        w.write(format, ns);
+        w.write<format>(ns);
 
         return { w, write_close_namespace };
     }
 
     void write_enum_field(writer& w, Field const& field)
     {
-        auto format = R"(        % = %,
-)";
+        static constexpr format_string format{ R"(        % = %,
+)" };
 
         if (auto constant = field.Constant())
         {
-            w.write(format, field.Name(), *constant);
+            w.write<format>(field.Name(), *constant);
         }
     }
 
     void write_enum(writer& w, TypeDef const& type)
     {
-        auto format = R"(    enum class % : %
+        static constexpr format_string format{ R"(    enum class % : %
     {
 %    };
-)";
+)" };
 
         auto fields = type.FieldList();
-        w.write(format, type.TypeName(), fields.first.Signature().Type(), bind_each<write_enum_field>(fields));
+        w.write<format>(type.TypeName(), fields.first.Signature().Type(), bind_each<write_enum_field>(fields));
+        ++w.declarations;
     }
 
     void write_delegate(writer& w, TypeDef const& type);
@@ -173,9 +229,10 @@ namespace cppwin32
     // Workaround for https://github.com/microsoft/cppwin32/issues/2
     void write_extern_forward(writer& w, TypeRef const& type)
     {
-        auto const format = R"(    struct %;
-)";
-        w.write(format, type.TypeName());
+        static constexpr format_string format{ R"(    struct %;
+)" };
+        w.write<format>(type.TypeName());
+        ++w.declarations;
     }
 
     void write_forward(writer& w, TypeDef const& type)
@@ -183,9 +240,10 @@ namespace cppwin32
         if (get_category(type) == category::enum_type)
         {
             type_name type_name(type);
-            auto format = R"(    enum class % : %;
-)";
-            w.write(format, type_name.name, type.FieldList().first.Signature().Type());
+            static constexpr format_string format{ R"(    enum class % : %;
+)" };
+            w.write<format>(type_name.name, type.FieldList().first.Signature().Type());
+            ++w.declarations;
             return;
         }
         else if (get_category(type) == category::delegate_type)
@@ -195,19 +253,13 @@ namespace cppwin32
         }
 
         std::string_view const type_keyword = is_union(type) ? "union" : "struct";
-        auto format = R"(    % %;
-)";
+        static constexpr format_string format{ R"(    % %;
+)" };
 
-        w.write(format, type_keyword, type.TypeName());
+        w.write<format>(type_keyword, type.TypeName());
+        ++w.declarations;
     }
 
-    struct struct_field
-    {
-        std::string_view name;
-        std::string type;
-        std::optional<int32_t> array_count;
-    };
-
     void write_nesting(writer& w, int nest_level)
     {
         for (int i = 0; i < nest_level; ++i)
@@ -216,17 +268,21 @@ namespace cppwin32
         }
     }
 
-    void write_struct_field(writer& w, struct_field const& field, int nest_level = 0)
+    void write_struct_field(writer& w, Field const& field, int nest_level = 0)
     {
-        if (field.array_count)
+        auto const signature = field.Signature();
+        auto const& field_type = signature.Type();
+
+        if (field_type.is_array())
         {
-            w.write("        %@ %[%];\n",
-                bind<write_nesting>(nest_level), field.type, field.name, field.array_count.value());
+            XLANG_ASSERT(field_type.array_rank() == 1);
+            w.write("        %% %[%];\n",
+                bind<write_nesting>(nest_level), field_type, field.Name(), static_cast<int32_t>(field_type.array_sizes()[0]));
         }
         else
         {
-            w.write("        %@ %;\n",
-                bind<write_nesting>(nest_level), field.type, field.name);
+            w.write("        %% %;\n",
+                bind<write_nesting>(nest_level), field_type, field.Name());
         }
     }
 
@@ -251,6 +307,37 @@ namespace cppwin32
         return result;
     }
 
+    // Whether a field of a type nested in the type, at any depth, points at the target. Nested types are
+    // defined in metadata order, so a pointer may name one that is defined later, or the dependency graph may
+    // have accepted a cycle of pointers between them, and either way the target must be declared first.
+    bool is_nested_pointer_target(TypeDef const& type, TypeDef const& target)
+    {
+        for (auto&& nested_type : type.get_cache().nested_types(type))
+        {
+            if (nested_type == target)
+            {
+                continue;
+            }
+
+            for (auto&& field : nested_type.FieldList())
+            {
+                auto const signature = field.Signature();
+
+                if (signature.Type().ptr_count() != 0 && get_nested_type(signature.Type()) == target)
+                {
+                    return true;
+                }
+            }
+
+            if (is_nested_pointer_target(nested_type, target))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
     void write_struct(writer& w, TypeDef const& type, int nest_level = 0)
     {
 #ifdef _DEBUG
@@ -260,71 +347,54 @@ namespace cppwin32
         }
 #endif
 
+        ++w.declarations;
         std::string_view const type_keyword = is_union(type) ? "union" : "struct";
         w.write(R"(    %% %
     %{
 )", bind<write_nesting>(nest_level), type_keyword, type.TypeName(), bind<write_nesting>(nest_level));
 
+        for (auto&& nested_type : type.get_cache().nested_types(type))
+        {
+            if (is_nested_pointer_target(type, nested_type))
+            {
+                ++w.declarations;
+                w.write("        %% %;\n",
+                    bind<write_nesting>(nest_level), is_union(nested_type) ? "union" : "struct", nested_type.TypeName());
+            }
+        }
+
         // Write nested types
         for (auto&& nested_type : type.get_cache().nested_types(type))
         {
             write_struct(w, nested_type, nest_level + 1);
         }
         
-        struct complex_struct
+        for (auto&& field : type.FieldList())
         {
-            complex_struct(writer& w, TypeDef const& type)
-                : type(type)
+            if (field.Flags().Literal())
             {
-                fields.reserve(size(type.FieldList()));
-                for (auto&& field : type.FieldList())
-                {
-                    if (field.Flags().Literal())
-                    {
-                        continue;
-                    }
-                    auto const name = field.Name();
-                    auto const signature = field.Signature();
-                    auto const field_type = signature.Type();
-
-                    std::optional<int32_t> array_count;
-                    if (field_type.is_array())
-                    {
-                        XLANG_ASSERT(field_type.array_rank() == 1);
-                        array_count = field_type.array_sizes()[0];
-                    }
-                    
-                    //if (auto nested_type = get_nested_type(field_type))
-                    //{
-                    //    if (nested_type.Flags().Layout() == TypeLayout::ExplicitLayout && nested_type.TypeName().find("_e__Union") != std::string_view::npos)
-                    //    {
-                    //        // TODO: unions
-                    //        continue;
-                    //    }
-                    //    else if (nested_type.TypeName().find("_e__Struct") != std::string_view::npos)
-                    //    {
-                    //        // TODO: unions
-                    //        continue;
-                    //    }
-                    //    continue;
-                    //}
-                    //auto const index = std::get_if<coded_index<TypeDefOrRef>>(&field_type.Type());
-                    //if (index && !find(*index))
-                    //{
-                    //    continue;
-                    //}
-                    fields.push_back({ name, w.write_temp("%", field_type), array_count });
-                }
+                continue;
             }
 
-            TypeDef type;
-            std::vector<struct_field> fields;
-        };
-
-        complex_struct s{ w, type };
-
-        for (auto&& field : s.fields)
-        {
+            //if (auto nested_type = get_nested_type(field.Signature().Type()))
+            //{
+            //    if (nested_type.Flags().Layout() == TypeLayout::ExplicitLayout && nested_type.TypeName().find("_e__Union") != std::string_view::npos)
+            //    {
+            //        // TODO: unions
+            //        continue;
+            //    }
+            //    else if (nested_type.TypeName().find("_e__Struct") != std::string_view::npos)
+            //    {
+            //        // TODO: unions
+            //        continue;
+            //    }
+            //    continue;
+            //}
+            //auto const index = std::get_if<coded_index<TypeDefOrRef>>(&field.Signature().Type().Type());
+            //if (index && !find(*index))
+            //{
+            //    continue;
+            //}
             write_struct_field(w, field, nest_level);
         }
 
@@ -344,155 +414,30 @@ namespace cppwin32
 )", bind<write_nesting>(nest_level));
     }
 
-    struct dependency_sorter
+    // A header may also define the types of namespaces it is shared with, so each run of types from one
+    // namespace is wrapped in that namespace.
+    template <typename F>
+    void write_in_namespaces(writer& w, std::vector<TypeDef> const& types, F write_type)
     {
-        dependency_sorter() = default;
-        explicit dependency_sorter(std::string_view type_namespace)
-            : type_namespace(type_namespace)
-        {}
-
-        struct node
+        for (auto first = types.begin(); first != types.end();)
         {
-            std::vector<TypeDef> edges;
-            bool temporary{};
-            bool permanent{};
+            auto const ns = first->TypeNamespace();
+            auto const last = std::find_if(first, types.end(), [&](TypeDef const& type) { return type.TypeNamespace() != ns; });
+            auto guard = wrap_type_namespace(w, ns);
 
-            // Number of edges on an individual node should be small, so linear search is fine.
-            void add_edge(TypeDef const& edge)
+            for (; first != last; ++first)
             {
-                if (std::find(edges.begin(), edges.end(), edge) == edges.end())
-                {
-                    edges.push_back(edge);
-                }
-            }
-        };
-
-        std::string_view type_namespace;
-        std::map<TypeDef, node> dependency_map;
-        using value_type = std::map<TypeDef, node>::value_type;
-
-        void add_struct(TypeDef const& type)
-        {
-            auto [it, inserted] = dependency_map.insert({ type, {} });
-            if (!inserted) return;
-            for (auto&& field : type.FieldList())
-            {
-                auto const signature = field.Signature();
-                if (auto const field_type = std::get_if<coded_index<TypeDefOrRef>>(&signature.Type().Type()))
-                {
-                    if (signature.Type().ptr_count() == 0 || is_nested(*field_type))
-                    {
-                        auto field_type_def = find(*field_type);
-                        if (field_type_def && get_category(field_type_def) != category::enum_type)
-                        {
-                            it->second.add_edge(field_type_def);
-                            add_struct(field_type_def);
-                        }
-                    }
-                }
+                write_type(w, *first);
             }
         }
+    }
 
-        void add_delegate(TypeDef const& type)
-        {
-            auto [it, inserted] = dependency_map.insert({ type, {} });
-            if (!inserted) return;
-            method_signature method_signature{ get_delegate_method(type) };
-            auto add_param = [this, current = it](TypeSig const& type)
-            {
-                auto index = std::get_if<coded_index<TypeDefOrRef>>(&type.Type());
-                if (index)
-                {
-                    auto param_type_def = find(*index);
-                    if (param_type_def && get_category(param_type_def) == category::delegate_type)
-                    {
-                        current->second.add_edge(param_type_def);
-                        add_delegate(param_type_def);
-                    }
-                }
-            };
-            add_param(method_signature.return_signature().Type());
-            for (auto const& [param, param_sig] : method_signature.params())
-            {
-                add_param(param_sig->Type());
-            }
-        }
-
-        void add_interface(TypeDef const& type)
-        {
-            auto [it, inserted] = dependency_map.insert({ type, {} });
-            if (!inserted) return;
-
-            auto const base_index = get_base_interface(type);
-            if (base_index)
-            {
-                auto const base_type = find(base_index);
-                if (base_type)
-                {
-                    it->second.add_edge(base_type);
-                    add_interface(base_type);
-                }
-            }
-        }
-
-        void visit(value_type& v, std::vector<TypeDef>& sorted)
-        {
-#ifdef _DEBUG
-            auto type_name = v.first.TypeName();
-#endif
-
-            if (v.second.permanent) return;
-            if (v.second.temporary) throw std::invalid_argument("Cyclic dependency graph encountered");
-
-            v.second.temporary = true;
-            for (auto&& edge : v.second.edges)
-            {
-                auto it = dependency_map.find(edge);
-                XLANG_ASSERT(it != dependency_map.end());
-                visit(*it, sorted);
-            }
-            v.second.temporary = false;
-            v.second.permanent = true;
-            sorted.push_back(v.first);
-        }
-
-        std::vector<TypeDef> sort()
-        {
-            std::vector<TypeDef> result;
-            auto eligible = [](value_type const& v) { return !v.second.permanent; };
-            for (auto it = std::find_if(dependency_map.begin(), dependency_map.end(), eligible)
-                ; it != dependency_map.end()
-                ; it = std::find_if(dependency_map.begin(), dependency_map.end(), eligible))
-            {
-                visit(*it, result);
-            }
-            return result;
-        }
-    };
-
-    void write_structs(writer& w, std::vector<TypeDef> const& structs)
+    void write_structs(writer& w)
     {
-        dependency_sorter ds;
-        for (auto&& type : structs)
-        {
-            ds.add_struct(type);
-        }
-        
-        auto sorted_structs = ds.sort();
-        for (auto&& type : sorted_structs)
-        {
-            if (type.TypeNamespace() == w.type_namespace)
+        write_in_namespaces(w, settings.dependencies->get(w.type_namespace).structs.types, [](writer& w, TypeDef const& type)
             {
-                if (get_category(type) == category::struct_type && !is_nested(type))
-                {
-                    write_struct(w, type);
-                }
-            }
-            else if (!is_nested(type))
-            {
-                w.add_depends(type);
-            }
-        }
+                write_struct(w, type);
+            });
     }
 
     void write_abi_params(writer& w, method_signature const& method_signature)
@@ -583,15 +528,16 @@ namespace cppwin32
         w.write(R"(extern "C"
 {
 )");
-        auto const format = R"xyz(    % __stdcall WIN32_IMPL_%(%) noexcept;
-)xyz";
+        static constexpr format_string format{ R"xyz(    % __stdcall WIN32_IMPL_%(%) noexcept;
+)xyz" };
 
         for (auto&& method : type.MethodList())
         {
-            if (method.Flags().Access() == MemberAccess::Public)
+            if (method.Flags().Access() == MemberAccess::Public && is_projected(method))
             {
                 method_signature signature{ method };
-                w.write(format, bind<write_abi_return>(signature.return_signature()), method.Name(), bind<write_abi_params>(signature));
+                w.write<format>(bind<write_abi_return>(signature.return_signature()), method.Name(), bind<write_abi_params>(signature));
+                ++w.declarations;
             }
         }
         w.write(R"(}
@@ -599,7 +545,7 @@ namespace cppwin32
 
         for (auto&& method : type.MethodList())
         {
-            if (method.Flags().Access() == MemberAccess::Public)
+            if (method.Flags().Access() == MemberAccess::Public && is_projected(method))
             {
                 method_signature signature{ method };
                 w.write("WIN32_IMPL_LINK(%)\n", bind<write_abi_link>(signature));
@@ -643,12 +589,12 @@ namespace cppwin32
 
     void write_class_method(writer& w, method_signature const& method_signature)
     {
-        auto const format = R"xyz(    inline % %(%)
+        static constexpr format_string format{ R"xyz(    inline % %(%)
     {
         %WIN32_IMPL_%(%);%
     }
-)xyz";
-        w.write(format,
+)xyz" };
+        w.write<format>(
             bind<write_method_return>(method_signature),
             method_signature.method().Name(),
             bind<write_method_params>(method_signature),
@@ -657,13 +603,34 @@ namespace cppwin32
             bind<write_method_args>(method_signature),
             bind<write_consume_return_statement>(method_signature)
         );
+        ++w.declarations;
+    }
+
+    void write_class_constant(writer& w, Field const& field)
+    {
+        auto const constant = field.Constant();
+        w.write("    inline constexpr % % = %;\n",
+            constant.Type(),
+            field.Name(),
+            constant);
+        ++w.declarations;
+    }
+
+    bool is_class_method(MethodDef const& method)
+    {
+        return method.Flags().Access() == MemberAccess::Public && is_projected(method);
+    }
+
+    bool is_class_constant(Field const& field)
+    {
+        return field.Flags().Literal() && is_projected(field);
     }
 
     void write_class(writer& w, TypeDef const& type)
     {
         for (auto&& method : type.MethodList())
         {
-            if (method.Flags().Access() == MemberAccess::Public)
+            if (is_class_method(method))
             {
                 method_signature signature{ method };
                 write_class_method(w, signature);
@@ -674,51 +641,82 @@ namespace cppwin32
 
         for (auto&& field : type.FieldList())
         {
-            if (field.Flags().Literal())
+            if (is_class_constant(field))
             {
-                auto const constant = field.Constant();
-                w.write("    inline constexpr % % = %;\n",
-                    constant.Type(),
-                    field.Name(),
-                    constant);
+                write_class_constant(w, field);
             }
         }
     }
 
+    // A fragment name is also part of an include guard and a module partition name, so it is reduced to
+    // lowercase letters, digits and underscores: KERNEL32.dll becomes kernel32 and api-ms-win-core-file-l1-1-0
+    // becomes api_ms_win_core_file_l1_1_0.
+    std::string get_fragment_name(MethodDef const& method)
+    {
+        auto dll = get_import_dll(method);
+
+        if (dll.empty())
+        {
+            return "other";
+        }
+
+        if (auto const extension = dll.rfind('.'); extension != std::string_view::npos)
+        {
+            dll = dll.substr(0, extension);
+        }
+
+        std::string result;
+
+        if (dll.empty() || (dll[0] >= '0' && dll[0] <= '9'))
+        {
+            result += '_';
+        }
+
+        for (auto c : dll)
+        {
+            if (c >= 'A' && c <= 'Z')
+            {
+                result += static_cast<char>(c - 'A' + 'a');
+            }
+            else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9'))
+            {
+                result += c;
+            }
+            else
+            {
+                result += '_';
+            }
+        }
+
+        return result;
+    }
+
     void write_delegate_params(writer& w, method_signature const& method_signature)
     {
         separator s{ w };
         for (auto&& [param, param_signature] : method_signature.params())
         {
             s();
-            std::string type;
-            type = w.write_temp("%", param_signature->Type());
-            w.write("%", type);
+            w.write(param_signature->Type());
         }
     }
 
     void write_delegate(writer& w, TypeDef const& type)
     {
-        auto const format = R"xyz(    using % = % __stdcall(%);
-)xyz";
+        static constexpr format_string format{ R"xyz(    using % = % __stdcall(%);
+)xyz" };
         method_signature method_signature{ get_delegate_method(type) };
 
-        w.write(format, type.TypeName(), bind<write_method_return>(method_signature), bind<write_delegate_params>(method_signature));
+        w.write<format>(type.TypeName(), bind<write_method_return>(method_signature), bind<write_delegate_params>(method_signature));
+        ++w.declarations;
     }
 
-    void write_delegates(writer& w, std::vector<TypeDef> const& delegates)
+    void write_delegates(writer& w)
     {
-        type_dependency_graph graph(w.type_namespace);
-
-        for (auto&& type : delegates)
+        for (auto&& type : settings.dependencies->get(w.type_namespace).delegates)
         {
-            graph.add_delegate(type);
+            write_delegate(w, type);
         }
-
-        graph.walk_graph([&w](TypeDef const& type)
-            {
-                write_delegate(w, type);
-            });
     }
 
     void write_enum_operators(writer& w, TypeDef const& type)
@@ -730,7 +728,7 @@ namespace cppwin32
 
         auto name = type.TypeName();
 
-        auto format = R"(    constexpr auto operator|(% const left, % const right) noexcept
+        static constexpr format_string format{ R"(    constexpr auto operator|(% const left, % const right) noexcept
     {
         return static_cast<%>(_impl_::to_underlying_type(left) | _impl_::to_underlying_type(right));
     }
@@ -761,8 +759,8 @@ namespace cppwin32
         left = left ^^ right;
         return left;
     }
-)";
-        w.write(format, name, name, name, name, name, name, name, name, name, name, name, name, name, name, name, name, name);
+)" };
+        w.write<format>(name, name, name, name, name, name, name, name, name, name, name, name, name, name, name, name, name);
     }
 
     struct guid
@@ -828,13 +826,14 @@ namespace cppwin32
         auto const guid_str = std::get<std::string_view>(std::get<ElemSig>(sig.FixedArgs()[0].value).value);
         auto const guid_value = to_guid(guid_str);
 
-        auto format = R"(    template <> inline constexpr guid guid_v<%>{ % }; // %
-)";
+        static constexpr format_string format{ R"(    template <> inline constexpr guid guid_v<%>{ % }; // %
+)" };
 
-        w.write(format,
+        w.write<format>(
             type,
             bind<write_guid_value>(guid_value),
             guid_str);
+        ++w.declarations;
     }
 
     void write_base_interface(writer& w, TypeDef const& type)
@@ -849,14 +848,15 @@ namespace cppwin32
     void write_interface(writer& w, TypeDef const& type)
     {
         {
-            auto const format = R"(    struct __declspec(novtable) %%
+            static constexpr format_string format{ R"(    struct __declspec(novtable) %%
     {
-)";
-            w.write(format, type.TypeName(), bind<write_base_interface>(type));
+)" };
+            w.write<format>(type.TypeName(), bind<write_base_interface>(type));
+            ++w.declarations;
         }
 
-        auto const format = R"(        virtual % __stdcall %(%) noexcept = 0;
-)";
+        static constexpr format_string format{ R"(        virtual % __stdcall %(%) noexcept = 0;
+)" };
         auto abi_guard = w.push_abi_types(true);
 
         // BUG: Workaround https://github.com/microsoft/win32metadata/issues/127
@@ -864,7 +864,7 @@ namespace cppwin32
         {
             for (auto&& method : type.MethodList())
             {
-                w.write(format, "void", method.Name(), "");
+                w.write<format>("void", method.Name(), "");
             }
             w.write(R"(    };
 )");
@@ -874,22 +874,16 @@ namespace cppwin32
         for (auto&& method : type.MethodList())
         {
             method_signature signature{ method };
-            w.write(format, bind<write_abi_return>(signature.return_signature()), method.Name(), bind<write_abi_params>(signature));
+            w.write<format>(bind<write_abi_return>(signature.return_signature()), method.Name(), bind<write_abi_params>(signature));
         }
 
         w.write(R"(    };
 )");
     }
 
-    void write_interfaces(writer& w, std::vector<TypeDef> const& interfaces)
+    void write_interfaces(writer& w)
     {
-        type_dependency_graph graph(w.type_namespace);
-        for (auto&& type : interfaces)
-        {
-            graph.add_interface(type);
-        }
-
-        graph.walk_graph([&w](TypeDef const& type)
+        write_in_namespaces(w, settings.dependencies->get(w.type_namespace).interfaces.types, [](writer& w, TypeDef const& type)
             {
                 write_interface(w, type);
             });
@@ -911,18 +905,28 @@ namespace cppwin32
             bind<write_consume_params>(signature));
     }
 
+    static void write_impl_name(writer& w, TypeDef const& type)
+    {
+        for (auto&& c : type.TypeNamespace())
+        {
+            w.write(c == '.' ? '_' : c);
+        }
+
+        w.write('_');
+        w.write(type.TypeName());
+    }
+
     void write_consume(writer& w, TypeDef const& type)
     {
         auto const& method_list = type.MethodList();
-        auto const impl_name = get_impl_name(type.TypeNamespace(), type.TypeName());
 
-        auto const format = R"(    struct consume_%
+        static constexpr format_string format{ R"(    struct consume_%
     {
 %    };
-)";
+)" };
 
-        w.write(format,
-            impl_name,
+        w.write<format>(
+            bind<write_impl_name>(type),
             bind_each<write_consume_declaration>(method_list));
     }
 
@@ -980,13 +984,13 @@ namespace cppwin32
         auto const method_name = method.Name();
         auto signature = method_signature(method);
 
-        auto const format = R"(    WIN32_IMPL_AUTO(%) consume_%::%(%) const
+        static constexpr format_string format{ R"(    WIN32_IMPL_AUTO(%) consume_%::%(%) const
     {
         %WIN32_IMPL_SHIM(%)->%(%);%
     }
-)";
+)" };
 
-        w.write(format,
+        w.write<format>(
             signature.return_signature(),
             type_impl_name,
             method_name,
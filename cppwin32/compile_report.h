@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "text_writer.h"
+
+namespace cppwin32
+{
+    // Estimates what each generated header costs a translation unit that includes it, without running the
+    // compiler. Every header reports its own size, the declarations it emits and the headers it includes,
+    // and the transitive closure of those includes gives the headers and bytes that come with it.
+    struct compile_report
+    {
+        struct file
+        {
+            uint64_t bytes{};
+            uint32_t declarations{};
+            std::vector<std::string> includes;
+        };
+
+        compile_report(compile_report const&) = delete;
+        compile_report& operator=(compile_report const&) = delete;
+
+        compile_report() = default;
+
+        // A file added again replaces what was recorded for it.
+        void add(std::string const& path, uint64_t const bytes, uint32_t const declarations, std::vector<std::string>&& includes)
+        {
+            std::lock_guard lock{ m_lock };
+            m_files[path] = { bytes, declarations, std::move(includes) };
+        }
+
+        // Writes <filename>.json with every file in path order and <filename>.txt with the most expensive first.
+        void write(std::string const& filename) const
+        {
+            std::lock_guard lock{ m_lock };
+            auto const rows = get_rows();
+
+            {
+                auto const json_path = filename + ".json";
+                std::ofstream json{ json_path, std::ios::out | std::ios::binary };
+                json << "{\"files\":[\n";
+                bool first{ true };
+
+                for (auto&& row : rows)
+                {
+                    if (!first)
+                    {
+                        json << ",\n";
+                    }
+
+                    first = false;
+                    json << "{\"path\":\"";
+                    write_escaped(json, row.path);
+                    json << "\",\"bytes\":" << row.value->bytes
+                        << ",\"declarations\":" << row.value->declarations
+                        << ",\"includes\":" << row.value->includes.size()
+                        << ",\"closure\":" << row.closure
+                        << ",\"total_bytes\":" << row.total_bytes << "}";
+                }
+
+                json << "\n]}\n";
+                close_output(json, json_path);
+            }
+
+            std::vector<row const*> order;
+            order.reserve(rows.size());
+
+            for (auto&& row : rows)
+            {
+                order.push_back(&row);
+            }
+
+            std::stable_sort(order.begin(), order.end(), [](row const* left, row const* right)
+                {
+                    return left->total_bytes > right->total_bytes;
+                });
+
+            auto const text_path = filename + ".txt";
+            std::ofstream text{ text_path, std::ios::out | std::ios::binary };
+            text << "total_bytes closure bytes declarations path\n";
+
+            for (auto&& row : order)
+            {
+                text << row->total_bytes << ' ' << row->closure << ' ' << row->value->bytes << ' '
+                    << row->value->declarations << ' ' << row->path << '\n';
+            }
+
+            close_output(text, text_path);
+        }
+
+    private:
+
+        struct row
+        {
+            std::string_view path;
+            file const* value;
+            uint32_t closure{};
+            uint64_t total_bytes{};
+        };
+
+        // The include graph is acyclic, but include guards would make a cycle harmless, so each file's
+        // closure is walked with a visited mark rather than summed from those of its includes, which would
+        // count shared headers more than once.
+        std::vector<row> get_rows() const
+        {
+            std::vector<row> rows;
+            std::map<std::string_view, uint32_t> ids;
+
+            for (auto&& [path, value] : m_files)
+            {
+                ids.emplace(path, static_cast<uint32_t>(rows.size()));
+                rows.push_back({ path, &value });
+            }
+
+            std::vector<std::vector<uint32_t>> edges(rows.size());
+
+            for (auto&& row : rows)
+            {
+                auto& row_edges = edges[ids[row.path]];
+
+                for (auto&& include : row.value->includes)
+                {
+                    // Headers from an earlier run that this run did not write are unknown and left out.
+                    auto it = ids.find(include);
+
+                    if (it != ids.end())
+                    {
+                        row_edges.push_back(it->second);
+                    }
+                }
+            }
+
+            std::vector<uint32_t> visited(rows.size(), UINT32_MAX);
+            std::vector<uint32_t> stack;
+
+            for (uint32_t id = 0; id != rows.size(); ++id)
+            {
+                auto& row = rows[id];
+                visited[id] = id;
+                stack.push_back(id);
+
+                while (!stack.empty())
+                {
+                    auto const current = stack.back();
+                    stack.pop_back();
+                    row.total_bytes += rows[current].value->bytes;
+
+                    for (auto next : edges[current])
+                    {
+                        if (visited[next] != id)
+                        {
+                            visited[next] = id;
+                            stack.push_back(next);
+                            ++row.closure;
+                        }
+                    }
+                }
+            }
+
+            return rows;
+        }
+
+        static void write_escaped(std::ofstream& file, std::string_view const& value)
+        {
+            for (auto c : value)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    file << '\\';
+                }
+
+                file << c;
+            }
+        }
+
+        std::map<std::string, file> m_files;
+        mutable std::mutex m_lock;
+    };
+}
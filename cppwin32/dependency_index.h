@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string_view>
+#include <vector>
+#include <winmd_reader.h>
+#include "helpers.h"
+#include "profiler.h"
+#include "type_dependency_graph.h"
+
+namespace cppwin32
+{
+    using namespace winmd::reader;
+
+    // The order in which the projected types must be declared. It is built once for all of the namespaces
+    // being projected and is read-only after that, so every writer can share it without locking.
+    // Three kinds of edges are recorded:
+    // - A struct depends on the structs it holds by value.
+    // - A delegate depends on the delegates in its own namespace that appear in its signature.
+    // - An interface depends on its base interface.
+    struct dependency_index
+    {
+        // The structs, or interfaces, of a namespace are defined in a header of their own, after the headers
+        // of the namespaces they depend on. Namespaces that depend on each other cannot be ordered that way,
+        // so the types of all of them are defined in the header of the first of them, the owner. types lists
+        // what the namespace's header defines, in declaration order, which for the others in such a group is
+        // nothing. Nested structs are written by their enclosing struct, so they are not listed.
+        struct header
+        {
+            std::string_view owner;
+            std::vector<TypeDef> types;
+            std::vector<std::string_view> group;
+            std::vector<std::string_view> depends;
+        };
+
+        struct slice
+        {
+            header structs;
+            header interfaces;
+            std::vector<TypeDef> delegates;
+        };
+
+        explicit dependency_index(std::map<std::string_view, cache::namespace_members> const& namespaces)
+        {
+            type_dependency_graph structs;
+            type_dependency_graph delegates;
+            type_dependency_graph interfaces;
+
+            {
+                profile_span span{ "dependencies", "graph build" };
+                std::vector<std::vector<TypeDef> const*> struct_batches;
+                std::vector<std::vector<TypeDef> const*> delegate_batches;
+                std::vector<std::vector<TypeDef> const*> interface_batches;
+
+                for (auto&& [ns, members] : namespaces)
+                {
+                    struct_batches.push_back(&members.structs);
+                    delegate_batches.push_back(&members.delegates);
+                    interface_batches.push_back(&members.interfaces);
+                }
+
+                structs.add(struct_batches, type_dependency_graph::struct_edges{});
+                delegates.add(delegate_batches, type_dependency_graph::delegate_edges{});
+                interfaces.add(interface_batches, type_dependency_graph::interface_edges{});
+            }
+
+            profile_span span{ "dependencies", "graph walk" };
+
+            for (auto&& [ns, members] : namespaces)
+            {
+                auto& slice = m_slices[ns];
+                slice.structs.owner = ns;
+                slice.interfaces.owner = ns;
+            }
+
+            add_headers(structs, &slice::structs);
+            add_headers(interfaces, &slice::interfaces);
+
+            delegates.walk_graph([&](TypeDef const& type)
+                {
+                    m_slices[type.TypeNamespace()].delegates.push_back(type);
+                });
+        }
+
+        dependency_index(dependency_index const&) = delete;
+        dependency_index& operator=(dependency_index const&) = delete;
+
+        slice const& get(std::string_view const& ns) const
+        {
+            static slice const empty;
+            auto it = m_slices.find(ns);
+            return it == m_slices.end() ? empty : it->second;
+        }
+
+        // Nested types have no namespace of their own and are written with the type that encloses them.
+        static std::string_view get_namespace(TypeDef type)
+        {
+            while (is_nested(type))
+            {
+                type = type.EnclosingType();
+            }
+
+            return type.TypeNamespace();
+        }
+
+    private:
+
+        // Namespaces that depend on each other are the cycles in a graph of namespaces. That graph is a
+        // type_dependency_graph in which each namespace is represented by the first of its types.
+        void add_headers(type_dependency_graph& types, header slice::* member)
+        {
+            std::vector<TypeDef> order;
+            std::map<std::string_view, std::set<std::string_view>> depends;
+            std::map<std::string_view, TypeDef> first_types;
+            std::map<TypeDef, std::string_view, row_less> namespace_of;
+
+            types.walk_graph([&](TypeDef const& type)
+                {
+                    if (!is_nested(type))
+                    {
+                        auto& owner = (m_slices[type.TypeNamespace()].*member).owner;
+
+                        if (owner.empty())
+                        {
+                            owner = type.TypeNamespace();
+                        }
+
+                        order.push_back(type);
+
+                        if (first_types.emplace(type.TypeNamespace(), type).second)
+                        {
+                            namespace_of.emplace(type, type.TypeNamespace());
+                        }
+                    }
+                });
+
+            types.for_each_edge([&](TypeDef const& type, TypeDef const& dependency)
+                {
+                    auto const type_namespace = get_namespace(type);
+                    auto const dependency_namespace = get_namespace(dependency);
+
+                    if (type_namespace != dependency_namespace)
+                    {
+                        depends[type_namespace].insert(dependency_namespace);
+                    }
+                });
+
+            type_dependency_graph graph;
+
+            for (auto&& [ns, type] : first_types)
+            {
+                graph.add(type, [&](TypeDef const& type, auto&& add_edge)
+                    {
+                        for (auto&& dependency : depends[namespace_of[type]])
+                        {
+                            auto it = first_types.find(dependency);
+
+                            if (it != first_types.end())
+                            {
+                                add_edge(it->second);
+                            }
+                        }
+                    });
+            }
+
+            auto const groups = graph.partition_graph();
+
+            for (auto&& cycle : groups.cycles)
+            {
+                auto const& members = groups.components[cycle.component];
+                auto const owner = namespace_of[members[cycle.position]];
+
+                for (auto position = cycle.position; position != cycle.position + cycle.size; ++position)
+                {
+                    auto const ns = namespace_of[members[position]];
+                    (m_slices[owner].*member).group.push_back(ns);
+                    (m_slices[ns].*member).owner = owner;
+                }
+            }
+
+            for (auto&& type : order)
+            {
+                auto const owner = (m_slices[type.TypeNamespace()].*member).owner;
+                (m_slices[owner].*member).types.push_back(type);
+            }
+
+            for (auto&& [ns, dependencies] : depends)
+            {
+                auto const owner = (m_slices[ns].*member).owner;
+                auto& owner_depends = (m_slices[owner].*member).depends;
+
+                for (auto&& dependency : dependencies)
+                {
+                    auto const dependency_owner = (m_slices[dependency].*member).owner;
+
+                    if (!dependency_owner.empty() && dependency_owner != owner)
+                    {
+                        owner_depends.push_back(dependency_owner);
+                    }
+                }
+            }
+
+            for (auto&& [ns, slice] : m_slices)
+            {
+                auto& value = slice.*member;
+                std::sort(value.depends.begin(), value.depends.end());
+                value.depends.erase(std::unique(value.depends.begin(), value.depends.end()), value.depends.end());
+            }
+        }
+
+        std::map<std::string_view, slice> m_slices;
+    };
+}
@@ -2,8 +2,64 @@
 
 namespace cppwin32
 {
+    // Each header has a partition of the win32 module that imports the partitions of the headers it includes
+    // and then includes the header itself, which leaves its own includes out once WIN32_MODULE is defined.
+    // The partition of a namespace header that was split re-exports those of its fragments.
+    static void write_namespace_ixx(writer const& header, char impl, std::string_view const& fragment = {})
+    {
+        auto const& ns = header.type_namespace;
+        writer w;
+        write_preamble(w);
+
+        if (fragment.empty())
+        {
+            write_module_prologue(w, w.write_temp("%", bind<write_partition_name>(ns, impl)));
+        }
+        else
+        {
+            write_module_prologue(w, w.write_temp("%.fragments.%", ns, fragment));
+        }
+
+        w.write("import :base;\n");
+
+        for (auto&& [import_ns, import_impl] : header.includes)
+        {
+            w.write("import :%;\n", bind<write_partition_name>(import_ns, import_impl));
+        }
+
+        for (auto&& import_fragment : header.fragments)
+        {
+            w.write("export import :%.fragments.%;\n", ns, import_fragment);
+        }
+
+        w.write("#define WIN32_MODULE\n");
+        write_module_export(w);
+        auto filename{ settings.output_folder + "win32/modules/" + ns };
+
+        if (impl)
+        {
+            w.write_root_include(w.write_temp("impl/%.%", ns, impl));
+            filename += '.';
+            filename += impl;
+        }
+        else if (!fragment.empty())
+        {
+            w.write_root_include(w.write_temp("fragments/%.%", ns, fragment));
+            filename += ".fragments.";
+            filename += fragment;
+        }
+        else
+        {
+            w.write_root_include(ns);
+        }
+
+        filename += ".ixx";
+        w.flush_to_file(filename);
+    }
+
     static void write_namespace_0_h(std::string_view const& ns, cache::namespace_members const& members)
     {
+        profile_span span{ "namespace_0_h", ns };
         writer w;
         w.type_namespace = ns;
 
@@ -20,7 +76,7 @@ namespace cppwin32
             w.write("#pragma endregion forward_declarations\n\n");
 
             w.write("#pragma region delegates\n");
-            write_delegates(w, members.delegates);
+            write_delegates(w);
             w.write("#pragma endregion delegates\n\n");
         }
         {
@@ -43,44 +99,74 @@ namespace cppwin32
             w.write_each<write_forward>(depends.second);
         }
 
+        span.bytes(w.size());
         w.save_header('0');
+
+        if (settings.modules)
+        {
+            write_namespace_ixx(w, '0');
+        }
     }
 
     static void write_namespace_1_h(std::string_view const& ns, cache::namespace_members const& members)
     {
+        profile_span span{ "namespace_1_h", ns };
         writer w;
         w.type_namespace = ns;
         
-        w.write("#include \"win32/impl/complex_structs.h\"\n");
-
-        {
-            auto wrap = wrap_type_namespace(w, ns);
+        auto const& slice = settings.dependencies->get(ns);
 
-            w.write("#pragma region interfaces\n");
-            //write_interfaces(w, members.interfaces);
-            w.write("#pragma endregion interfaces\n\n");
-        }
+        w.write("#pragma region structs\n");
+        write_structs(w);
+        w.write("#pragma endregion structs\n\n");
 
         write_close_file_guard(w);
         w.swap();
         write_preamble(w);
         write_open_file_guard(w, ns, '1');
 
-        for (auto&& depends : w.depends)
         {
-            w.write_depends(depends.first, '0');
+            auto module_guard = wrap_module_guard(w);
+
+            for (auto&& depends : w.depends)
+            {
+                w.write_depends(depends.first, '0');
+            }
+
+            w.write_depends(w.type_namespace, '0');
+
+            // The structs held by value have to be defined first.
+            for (auto&& depends : slice.structs.depends)
+            {
+                w.write_depends(depends, '1');
+            }
+
+            if (slice.structs.owner != ns)
+            {
+                w.write_depends(slice.structs.owner, '1');
+            }
         }
 
-        w.write_depends(w.type_namespace, '0');
+        span.bytes(w.size());
         w.save_header('1');
+
+        if (settings.modules)
+        {
+            write_namespace_ixx(w, '1');
+        }
     }
 
     static void write_namespace_2_h(std::string_view const& ns, cache::namespace_members const& members)
     {
+        profile_span span{ "namespace_2_h", ns };
         writer w;
         w.type_namespace = ns;
 
-        w.write("#include \"win32/impl/complex_interfaces.h\"\n");
+        auto const& slice = settings.dependencies->get(ns);
+
+        w.write("#pragma region interfaces\n");
+        write_interfaces(w);
+        w.write("#pragma endregion interfaces\n\n");
 
         {
             // No namespace
@@ -94,119 +180,280 @@ namespace cppwin32
         write_preamble(w);
         write_open_file_guard(w, ns, '2');
 
-        w.write_depends(w.type_namespace, '1');
+        {
+            auto module_guard = wrap_module_guard(w);
+
+            // Parameters may be structs passed by value, so their definitions are included.
+            for (auto&& depends : w.depends)
+            {
+                w.write_depends(depends.first, '1');
+            }
+
+            w.write_depends(w.type_namespace, '1');
+
+            // Base interfaces have to be defined first.
+            for (auto&& depends : slice.interfaces.depends)
+            {
+                w.write_depends(depends, '2');
+            }
+
+            if (slice.interfaces.owner != ns)
+            {
+                w.write_depends(slice.interfaces.owner, '2');
+            }
+        }
+
         // Workaround for https://github.com/microsoft/cppwin32/issues/2
         for (auto&& extern_depends : w.extern_depends)
         {
             auto guard = wrap_type_namespace(w, extern_depends.first);
             w.write_each<write_extern_forward>(extern_depends.second);
         }
+        span.bytes(w.size());
         w.save_header('2');
-    }
 
-    static void write_namespace_h(std::string_view const& ns, cache::namespace_members const& members)
-    {
-        writer w;
-        w.type_namespace = ns;
+        if (settings.modules)
         {
-            auto wrap = wrap_type_namespace(w, ns);
-
-            w.write("#pragma region methods\n");
-            w.write_each<write_class>(members.classes);
-            w.write("#pragma endregion methods\n\n");
+            write_namespace_ixx(w, '2');
         }
+    }
 
+    // Finishes the namespace header, or one of its fragments, once w holds its methods, and returns its size.
+    static uint64_t save_namespace_h(writer& w, std::string_view const& fragment = {})
+    {
         write_close_file_guard(w);
         w.swap();
         write_preamble(w);
-        write_open_file_guard(w, ns);
-        write_version_assert(w);
 
-        w.write_depends(w.type_namespace, '2');
+        if (fragment.empty())
+        {
+            write_open_file_guard(w, w.type_namespace);
+        }
+        else
+        {
+            write_open_file_guard(w, w.write_temp("%.%", w.type_namespace, fragment));
+        }
+
+        {
+            auto module_guard = wrap_module_guard(w);
+
+            write_version_assert(w);
+
+            // The methods take and return structs by value, so those have to be defined.
+            for (auto&& depends : w.depends)
+            {
+                w.write_depends(depends.first, '1');
+            }
+
+            w.write_depends(w.type_namespace, '2');
+        }
+
         // Workaround for https://github.com/microsoft/cppwin32/issues/2
         for (auto&& extern_depends : w.extern_depends)
         {
             auto guard = wrap_type_namespace(w, extern_depends.first);
             w.write_each<write_extern_forward>(extern_depends.second);
         }
-        w.save_header();
+
+        auto const size = w.size();
+
+        if (fragment.empty())
+        {
+            w.save_header();
+        }
+        else
+        {
+            w.save_fragment(fragment);
+        }
+
+        if (settings.modules)
+        {
+            write_namespace_ixx(w, char{}, fragment);
+        }
+
+        return size;
     }
 
-    static void write_complex_structs_h(cache const& c)
+    // Splits the methods of a namespace by the DLL they are imported from, with the constants on their own.
+    // Each part gets a fragment header, and the namespace header includes all of them.
+    static std::vector<std::string> write_namespace_fragments(std::string_view const& ns, cache::namespace_members const& members)
     {
-        writer w;
+        std::map<std::string, std::vector<MethodDef>> methods;
+        std::vector<Field> constants;
 
-        type_dependency_graph graph;
-        for (auto&& [ns, members] : c.namespaces())
+        for (auto&& type : members.classes)
         {
-            for (auto&& s : members.structs)
+            for (auto&& method : type.MethodList())
+            {
+                if (is_class_method(method))
+                {
+                    methods[get_fragment_name(method)].push_back(method);
+                }
+            }
+
+            for (auto&& field : type.FieldList())
             {
-                graph.add_struct(s);
+                if (is_class_constant(field))
+                {
+                    constants.push_back(field);
+                }
             }
         }
 
-        graph.walk_graph([&](TypeDef const& type)
+        writer umbrella;
+        umbrella.type_namespace = ns;
+        write_preamble(umbrella);
+        write_open_file_guard(umbrella, ns);
+
+        {
+            auto module_guard = wrap_module_guard(umbrella);
+            write_version_assert(umbrella);
+
+            for (auto&& [fragment, fragment_methods] : methods)
             {
-                if (!is_nested(type))
+                profile_span span{ "namespace_fragment_h", umbrella.write_temp("%.%", ns, fragment) };
+                writer w;
+                w.type_namespace = ns;
+
                 {
-                    auto guard = wrap_type_namespace(w, type.TypeNamespace());
-                    write_struct(w, type);
+                    auto wrap = wrap_type_namespace(w, ns);
+
+                    w.write("#pragma region methods\n");
+
+                    for (auto&& method : fragment_methods)
+                    {
+                        write_class_method(w, method_signature{ method });
+                    }
+
+                    w.write("#pragma endregion methods\n\n");
                 }
-            });
 
-        write_close_file_guard(w);
-        w.swap();
+                span.bytes(save_namespace_h(w, fragment));
+                umbrella.write_fragment_include(fragment);
+            }
 
-        write_preamble(w);
-        write_open_file_guard(w, "complex_structs");
+            if (!constants.empty())
+            {
+                profile_span span{ "namespace_fragment_h", umbrella.write_temp("%.constants", ns) };
+                writer w;
+                w.type_namespace = ns;
 
-        for (auto&& depends : w.depends)
+                {
+                    auto wrap = wrap_type_namespace(w, ns);
+
+                    w.write("#pragma region constants\n");
+                    w.write_each<write_class_constant>(constants);
+                    w.write("#pragma endregion constants\n\n");
+                }
+
+                span.bytes(save_namespace_h(w, "constants"));
+                umbrella.write_fragment_include("constants");
+            }
+        }
+
+        write_close_file_guard(umbrella);
+        umbrella.save_header();
+
+        if (settings.modules)
         {
-            w.write_depends(depends.first, '0');
+            write_namespace_ixx(umbrella, char{});
         }
 
-        w.flush_to_file(settings.output_folder + "win32/impl/complex_structs.h");
+        return std::move(umbrella.fragments);
     }
 
-    static void write_complex_interfaces_h(cache const& c)
+    // Returns the fragments the namespace header was split into, if any.
+    static std::vector<std::string> write_namespace_h(std::string_view const& ns, cache::namespace_members const& members)
     {
+        profile_span span{ "namespace_h", ns };
         writer w;
+        w.type_namespace = ns;
+        {
+            auto wrap = wrap_type_namespace(w, ns);
 
-        type_dependency_graph graph;
-        for (auto&& [ns, members] : c.namespaces())
+            w.write("#pragma region methods\n");
+            w.write_each<write_class>(members.classes);
+            w.write("#pragma endregion methods\n\n");
+        }
+
+        // The methods are written once to learn the size of the header, and only the few namespaces over
+        // the limit are written a second time as fragments.
+        if (settings.fragment_limit && w.size() > settings.fragment_limit)
         {
-            for (auto&& s : members.interfaces)
-            {
-                graph.add_interface(s);
-            }
+            return write_namespace_fragments(ns, members);
         }
 
-        graph.walk_graph([&](TypeDef const& type)
+        span.bytes(save_namespace_h(w));
+        return {};
+    }
+
+    // Removes the fragment headers and partitions of regenerated namespaces that this run did not write again,
+    // because the namespace is now under the limit or no longer imports from some DLL. The files are named
+    // <namespace><infix>.<fragment><extension>, and a fragment name never contains a dot. Namespaces that were
+    // skipped as current have no entry and keep theirs.
+    static void remove_stale_fragments(std::map<std::string_view, std::vector<std::string>> const& written)
+    {
+        auto remove = [&](std::string const& folder, std::string_view const& infix, std::string_view const& extension)
+        {
+            std::error_code error;
+
+            for (auto&& entry : std::filesystem::directory_iterator(folder, error))
             {
-                if (!is_nested(type))
+                auto const filename = entry.path().filename().string();
+                std::string_view stem{ filename };
+
+                if (stem.size() <= extension.size() || stem.substr(stem.size() - extension.size()) != extension)
                 {
-                    auto guard = wrap_type_namespace(w, type.TypeNamespace());
-                    write_interface(w, type);
+                    continue;
                 }
-            });
 
-        write_close_file_guard(w);
-        w.swap();
+                stem.remove_suffix(extension.size());
+                auto const dot = stem.rfind('.');
 
-        write_preamble(w);
-        write_open_file_guard(w, "complex_interfaces");
+                if (dot == std::string_view::npos || dot < infix.size() || stem.substr(dot - infix.size(), infix.size()) != infix)
+                {
+                    continue;
+                }
 
-        for (auto&& depends : w.depends)
+                auto const it = written.find(stem.substr(0, dot - infix.size()));
+
+                if (it != written.end() && std::find(it->second.begin(), it->second.end(), stem.substr(dot + 1)) == it->second.end())
+                {
+                    std::filesystem::remove(entry.path(), error);
+                }
+            }
+        };
+
+        remove(settings.output_folder + "win32/fragments", {}, ".h");
+        remove(settings.output_folder + "win32/modules", ".fragments", ".ixx");
+    }
+
+    // The primary interface of the win32 module re-exports base.h and every partition.
+    static void write_module_ixx(std::map<std::string_view, cache::namespace_members> const& namespaces)
+    {
         {
-            w.write_depends(depends.first, '1');
+            writer w;
+            write_preamble(w);
+            write_module_prologue(w, "base");
+            write_module_export(w);
+            w.write_root_include("base");
+            w.flush_to_file(settings.output_folder + "win32/modules/base.ixx");
         }
-        // Workaround for https://github.com/microsoft/cppwin32/issues/2
-        for (auto&& extern_depends : w.extern_depends)
+
+        writer w;
+        write_preamble(w);
+        w.write(R"(export module win32;
+export import :base;
+)");
+
+        for (auto&& [ns, members] : namespaces)
         {
-            auto guard = wrap_type_namespace(w, extern_depends.first);
-            w.write_each<write_extern_forward>(extern_depends.second);
+            for (char impl : { '0', '1', '2', char{} })
+            {
+                w.write("export import :%;\n", bind<write_partition_name>(ns, impl));
+            }
         }
 
-        w.flush_to_file(settings.output_folder + "win32/impl/complex_interfaces.h");
+        w.flush_to_file(settings.output_folder + "win32/modules/win32.ixx");
     }
-}
\ No newline at end of file
+}
@@ -6,6 +6,25 @@ namespace cppwin32
 
     template <typename...T> struct visit_overload : T... { using T::operator()...; };
 
+    // Rows from different databases share index values, so rows only compare by index within a database.
+    // Ties are broken by the database path rather than its address so that iteration order, and with it the
+    // output, is the same from run to run.
+    struct row_less
+    {
+        template <typename T>
+        bool operator()(T const& left, T const& right) const noexcept
+        {
+            if (left.index() != right.index())
+            {
+                return left.index() < right.index();
+            }
+
+            auto const left_database = &left.get_database();
+            auto const right_database = &right.get_database();
+            return left_database != right_database && left_database->path() < right_database->path();
+        }
+    };
+
     template <typename V, typename...C>
     auto call(V&& variant, C&&...call)
     {
@@ -259,6 +278,45 @@ namespace cppwin32
         return invoke;
     }
 
+    // The DLL that a method is imported from, or nothing for a method without a P/Invoke mapping. The ImplMap
+    // table is sorted by the member it forwards, so the mapping is found with a binary search.
+    inline std::string_view get_import_dll(MethodDef const& method)
+    {
+        auto const& table = method.get_database().ImplMap;
+        auto const key = std::pair{ method.index(), MemberForwarded::MethodDef };
+        uint32_t first{};
+        uint32_t count = table.size();
+
+        while (count)
+        {
+            auto const step = count / 2;
+            auto const forwarded = table[first + step].MemberForwarded();
+
+            if (std::pair{ forwarded.index(), forwarded.type() } < key)
+            {
+                first += step + 1;
+                count -= step + 1;
+            }
+            else
+            {
+                count = step;
+            }
+        }
+
+        if (first != table.size())
+        {
+            auto const map = table[first];
+            auto const forwarded = map.MemberForwarded();
+
+            if (std::pair{ forwarded.index(), forwarded.type() } == key)
+            {
+                return map.ImportScope().Name();
+            }
+        }
+
+        return {};
+    }
+
     coded_index<TypeDefOrRef> get_base_interface(TypeDef const& type)
     {
         auto bases = type.InterfaceImpl();
@@ -3,10 +3,19 @@
 #include "settings.h"
 #include "task_group.h"
 #include "text_writer.h"
+#include "profiler.h"
+#include "compile_report.h"
+#include "output_stage.h"
 #include "type_dependency_graph.h"
+#include "dependency_index.h"
 #include "type_writers.h"
+#include "manifest.h"
+#include "type_closure.h"
+#include "source_scan.h"
 #include "code_writers.h"
 #include "file_writers.h"
+#include "allocation_count.h"
+#include <optional>
 #include <unordered_set>
 
 using namespace std::filesystem;
@@ -27,6 +36,15 @@ namespace cppwin32
         { "include", 0, option::no_max, "<prefix>", "One or more prefixes to include in input" },
         { "exclude", 0, option::no_max, "<prefix>", "One or more prefixes to exclude from input" },
         { "base", 0, 0, {}, "Generate base.h unconditionally" },
+        { "jobs", 0, 1, "<count>", "Maximum number of worker threads (defaults to processor count)" },
+        { "profile", 0, 1, "<file>", "Write a Chrome trace of the generator's tasks and phases" },
+        { "report", 0, 1, "<file>", "Write the size and include closure of each header to <file>.json and <file>.txt" },
+        { "memory", 0, 1, "<megabytes>", "Approximate limit on memory used for buffered output" },
+        { "roots", 0, 1, "<file>", "Project only the listed types, functions and constants and their dependencies" },
+        { "scan", 0, option::no_max, "<path>", "Project only what the C++ sources in the folders use and their dependencies" },
+        { "stamps", 0, 0, {}, "Record output file stamps so that unchanged files need not be read back" },
+        { "modules", 0, 0, {}, "Also generate a C++20 module partition for each header" },
+        { "fragments", 0, 1, "<KB>", "Split namespace headers larger than <KB> into a header per DLL, included by the namespace header" },
         { "help", 0, option::no_max, {}, "Show detailed help with examples" },
         { "?", 0, option::no_max, {}, {} },
         { "library", 0, 1, "<prefix>", "Specify library prefix (defaults to win32)" },
@@ -52,7 +70,7 @@ namespace cppwin32
             printColumns(w, w.write_temp("-% %", opt.name, opt.arg), opt.desc);
         };
 
-        auto format = R"(
+        static constexpr format_string format{ R"(
 C++/Win32 v%
 Copyright (c) Microsoft Corporation. All rights reserved.
 
@@ -65,8 +83,44 @@ Options:
 Where <spec> is one or more of:
 
   path                Path to winmd file or recursively scanned folder
-)";
-        w.write(format, CPPWIN32_VERSION_STRING, bind_each(printOption, options));
+)" };
+        w.write<format>(CPPWIN32_VERSION_STRING, bind_each(printOption, options));
+    }
+
+    // Parses a positive size given in units of the given number of bytes and returns it in bytes.
+    static uint64_t parse_size(std::string_view const& name, std::string_view const& value, uint64_t const unit)
+    {
+        uint64_t result{};
+        auto const last = value.data() + value.size();
+        auto const [ptr, error] = std::from_chars(value.data(), last, result);
+
+        if (error != std::errc{} || ptr != last || result == 0)
+        {
+            throw_invalid("Option '", name, "' requires a positive number, not '", value, "'");
+        }
+
+        if (result > UINT64_MAX / unit)
+        {
+            throw_invalid("Option '", name, "' is too large: '", value, "'");
+        }
+
+        return result * unit;
+    }
+
+    // A run that ends abnormally can leave the files writers spill their bodies to behind.
+    static void remove_stale_spills()
+    {
+        std::error_code error;
+
+        for (auto&& entry : std::filesystem::directory_iterator(settings.output_folder + "win32/impl", error))
+        {
+            auto const filename = entry.path().filename().string();
+
+            if (filename.rfind("cppwin32_", 0) == 0 && entry.path().extension() == ".spill")
+            {
+                std::filesystem::remove(entry.path(), error);
+            }
+        }
     }
 
     static void process_args(reader const& args)
@@ -82,9 +136,41 @@ Where <spec> is one or more of:
 
         settings.license = args.exists("license");
         settings.brackets = args.exists("brackets");
+        settings.modules = args.exists("modules");
+
+        if (auto const jobs = args.value("jobs"); !jobs.empty())
+        {
+            auto const last = jobs.data() + jobs.size();
+            auto const [ptr, error] = std::from_chars(jobs.data(), last, settings.jobs);
+
+            if (error != std::errc{} || ptr != last || settings.jobs == 0)
+            {
+                throw_invalid("Option 'jobs' requires a positive number, not '", jobs, "'");
+            }
+        }
+
+        if (auto const memory = args.value("memory"); !memory.empty())
+        {
+            settings.memory_budget = parse_size("memory", memory, 1024 * 1024);
+        }
+
+        if (auto const fragments = args.value("fragments"); !fragments.empty())
+        {
+            settings.fragment_limit = parse_size("fragments", fragments, 1024);
+        }
 
         std::filesystem::path output_folder = args.value("output");
         std::filesystem::create_directories(output_folder / "win32/impl");
+
+        if (settings.modules)
+        {
+            std::filesystem::create_directories(output_folder / "win32/modules");
+        }
+
+        if (settings.fragment_limit)
+        {
+            std::filesystem::create_directories(output_folder / "win32/fragments");
+        }
         settings.output_folder = std::filesystem::canonical(output_folder).string();
         settings.output_folder += '\\';
 
@@ -151,6 +237,149 @@ Where <spec> is one or more of:
         return files;
     }
 
+    // Rough estimate of the work needed to project a set of types, used to start the largest tasks first.
+    static uint64_t get_members_cost(std::vector<TypeDef> const& types)
+    {
+        uint64_t cost{};
+
+        for (auto&& type : types)
+        {
+            cost += 1 + size(type.FieldList()) + size(type.MethodList());
+        }
+
+        return cost;
+    }
+
+    static uint64_t get_namespace_cost(cache::namespace_members const& members)
+    {
+        return get_members_cost(members.enums)
+            + get_members_cost(members.delegates)
+            + get_members_cost(members.classes)
+            + members.structs.size()
+            + members.interfaces.size();
+    }
+
+    static bool namespace_headers_exist(std::string_view const& ns)
+    {
+        auto const impl = settings.output_folder + "win32/impl/" + std::string{ ns };
+
+        auto const modules = settings.output_folder + "win32/modules/" + std::string{ ns };
+
+        return std::filesystem::exists(settings.output_folder + "win32/" + std::string{ ns } + ".h")
+            && std::filesystem::exists(impl + ".0.h")
+            && std::filesystem::exists(impl + ".1.h")
+            && std::filesystem::exists(impl + ".2.h")
+            && (!settings.modules || (std::filesystem::exists(modules + ".ixx")
+                && std::filesystem::exists(modules + ".0.ixx")
+                && std::filesystem::exists(modules + ".1.ixx")
+                && std::filesystem::exists(modules + ".2.ixx")));
+    }
+
+    // Projects the namespaces through the output stage. Namespaces whose fingerprint matches the previous
+    // manifest are skipped, so passing no previous manifest regenerates everything.
+    static void generate(std::map<std::string_view, cache::namespace_members> const& namespaces, uint64_t const projection, manifest const* previous, manifest& current, output_stage& output)
+    {
+        settings.output = &output;
+
+        for (auto&& [ns, members] : namespaces)
+        {
+            current.fingerprints.emplace(ns, 0);
+        }
+
+        {
+            profile_span span{ "fingerprints", "namespaces" };
+            task_group group{ settings.jobs };
+
+            for (auto&& [ns, members] : namespaces)
+            {
+                group.add([&, &ns = ns, &members = members, &fingerprint = current.fingerprints.find(ns)->second]
+                    {
+                        fingerprint = get_namespace_fingerprint(ns, members, projection);
+                    }, get_namespace_cost(members));
+            }
+
+            group.get();
+        }
+
+        // Namespaces that share a struct or interface header are only current if all of them are.
+        auto const own_fingerprints = current.fingerprints;
+
+        for (auto&& [ns, fingerprint] : current.fingerprints)
+        {
+            auto const& slice = settings.dependencies->get(ns);
+            auto const& struct_group = settings.dependencies->get(slice.structs.owner).structs.group;
+            auto const& interface_group = settings.dependencies->get(slice.interfaces.owner).interfaces.group;
+
+            if (struct_group.empty() && interface_group.empty())
+            {
+                continue;
+            }
+
+            cppwin32::fingerprint combined;
+
+            for (auto&& group : { &struct_group, &interface_group })
+            {
+                for (auto&& member : *group)
+                {
+                    auto it = own_fingerprints.find(member);
+                    combined.add(it == own_fingerprints.end() ? 0 : it->second);
+                }
+            }
+
+            fingerprint = combined.value;
+        }
+
+        // The fragments each namespace was split into, or nullopt if it was skipped as current.
+        std::map<std::string_view, std::optional<std::vector<std::string>>> fragments;
+
+        for (auto&& [ns, members] : namespaces)
+        {
+            fragments.emplace(ns, std::nullopt);
+        }
+
+        task_group group{ settings.jobs };
+
+        for (auto&& [ns, members] : namespaces)
+        {
+            group.add([&, &ns = ns, &members = members, fingerprint = current.fingerprints.find(ns)->second, &written = fragments.find(ns)->second]
+                {
+                    profile_span span{ "namespace", ns };
+
+                    if (previous && previous->is_current(ns, fingerprint) && namespace_headers_exist(ns))
+                    {
+                        return;
+                    }
+
+                    write_namespace_0_h(ns, members);
+                    write_namespace_1_h(ns, members);
+                    write_namespace_2_h(ns, members);
+                    written = write_namespace_h(ns, members);
+                }, get_namespace_cost(members));
+        }
+
+        group.get();
+
+        if (settings.modules)
+        {
+            write_module_ixx(namespaces);
+        }
+
+        output.close();
+        settings.output = nullptr;
+
+        std::map<std::string_view, std::vector<std::string>> regenerated;
+
+        for (auto&& [ns, written] : fragments)
+        {
+            if (written)
+            {
+                regenerated.emplace(ns, std::move(*written));
+            }
+        }
+
+        remove_stale_fragments(regenerated);
+    }
+
     static int run(int const argc, char* argv[])
     {
         int result{};
@@ -158,7 +387,7 @@ Where <spec> is one or more of:
 
         try
         {
-            auto const start_time = std::chrono::high_resolution_clock::now();
+            auto const start_time = std::chrono::steady_clock::now();
 
             reader args{ argc, argv, options };
 
@@ -168,25 +397,123 @@ Where <spec> is one or more of:
             }
 
             process_args(args);
+            remove_stale_spills();
+
+            std::optional<profiler> profile;
+            auto const profile_path = args.value("profile");
+
+            if (!profile_path.empty())
+            {
+                settings.profile = &profile.emplace(start_time);
+            }
+
+            std::optional<compile_report> report;
+            auto const report_path = args.value("report");
+
+            if (!report_path.empty())
+            {
+                settings.report = &report.emplace();
+            }
+
             cache c{ get_files_to_cache() };
-            task_group group;
+            projection_roots roots;
+            auto const roots_path = args.value("roots");
+            auto const& scan_paths = args.values("scan");
 
-            w.flush_to_console();
+            if (!roots_path.empty() || !scan_paths.empty())
+            {
+                profile_span span{ "roots", "closure" };
+                std::vector<TypeDef> found;
+
+                if (!roots_path.empty())
+                {
+                    read_roots(c, roots_path, roots, found);
+                }
+
+                for (auto&& path : scan_paths)
+                {
+                    scan_sources(c, path, roots, found);
+                }
 
-            for (auto&& [ns, members] : c.namespaces())
+                compute_closure(c, roots, std::move(found));
+                settings.roots = &roots;
+            }
+
+            auto const& namespaces = settings.roots ? roots.namespaces : c.namespaces();
+            dependency_index dependencies{ namespaces };
+            settings.dependencies = &dependencies;
+            // The output stage has an I/O thread for every four worker threads. Its queue holds 16 MB per worker
+            // thread, or half of any memory budget, in which case the other half is shared between the writers that
+            // can be active at once, each of which spills its body to disk once it outgrows its share.
+            auto const jobs = settings.jobs ? settings.jobs : (std::max)(1u, std::thread::hardware_concurrency());
+            auto const output_threads = (std::max)(1u, jobs / 4);
+            uint64_t output_capacity = uint64_t{ 16 * 1024 * 1024 } * jobs;
+
+            if (settings.memory_budget)
             {
-                group.add([&, &ns = ns, &members = members]
-                    {
-                        write_namespace_0_h(ns, members);
-                        write_namespace_1_h(ns, members);
-                        write_namespace_2_h(ns, members);
-                        write_namespace_h(ns, members);
-                    });
+                output_capacity = settings.memory_budget / 2;
+                settings.spill_limit = static_cast<size_t>((std::clamp)(settings.memory_budget / 2 / jobs, uint64_t{ 1024 * 1024 }, uint64_t{ SIZE_MAX }));
             }
-            group.add([&c] { write_complex_structs_h(c); });
-            group.add([&c] { write_complex_interfaces_h(c); });
+
+            std::optional<file_stamps> stamps;
+
+            if (args.exists("stamps"))
+            {
+                stamps.emplace().read();
+            }
+
+            w.flush_to_console();
+
+            auto const previous = manifest::read();
+            manifest current;
 
             std::filesystem::copy_file("base.h", settings.output_folder + "win32/" + "base.h", std::filesystem::copy_options::overwrite_existing);
+
+            if (report)
+            {
+                auto const path = writer::get_header_path("base");
+                report->add(path, std::filesystem::file_size(settings.output_folder + path), 0, {});
+            }
+
+            output_stage output{ output_threads, static_cast<size_t>((std::min)(output_capacity, uint64_t{ SIZE_MAX })), stamps ? &*stamps : nullptr };
+
+            // The report needs every header, so none are skipped as unchanged.
+            generate(namespaces, roots.fingerprint, report ? nullptr : &previous, current, output);
+            current.write();
+
+            if (stamps)
+            {
+                stamps->write();
+            }
+
+            if (profile)
+            {
+                settings.profile = nullptr;
+                profile->write(profile_path);
+            }
+
+            if (report)
+            {
+                settings.report = nullptr;
+                report->write(report_path);
+            }
+
+            if (settings.verbose)
+            {
+                using namespace std::chrono;
+                auto const stats = output.stats();
+
+                w.write("files written: % of %\n", stats.files_written, stats.files);
+                w.write("files unchanged: % (% known from stamps)\n", stats.files - stats.files_written, stats.files_unread);
+                w.write("bytes written: %\n", stats.bytes_written);
+                w.write("time blocked on full queue: %ms\n", duration_cast<milliseconds>(stats.blocked).count());
+                w.write("time queued for I/O: %ms\n", duration_cast<milliseconds>(stats.queued).count());
+                w.write("time comparing and writing: %ms\n", duration_cast<milliseconds>(stats.writing).count());
+                w.write("time total: %ms\n", duration_cast<milliseconds>(steady_clock::now() - start_time).count());
+#ifdef CPPWIN32_COUNT_ALLOCATIONS
+                w.write("heap allocations: %\n", allocations.load());
+#endif
+            }
         }
         catch (usage_exception const&)
         {
@@ -205,7 +532,7 @@ Where <spec> is one or more of:
 
 int main(int const argc, char* argv[])
 {
-    cppwin32::run(argc, argv);
+    return cppwin32::run(argc, argv);
 
     //// Hack prototype command line args for now
     //o.input = argv[1];
@@ -0,0 +1,395 @@
+#pragma once
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <winmd_reader.h>
+#include "cmd_reader.h"
+#include "helpers.h"
+#include "text_writer.h"
+
+namespace cppwin32
+{
+    using namespace winmd::reader;
+
+    // FNV-1a, which is plenty for telling whether the metadata behind a namespace changed between runs.
+    struct fingerprint
+    {
+        uint64_t value{ 14695981039346656037ull };
+
+        void add_bytes(void const* data, size_t const size) noexcept
+        {
+            auto const bytes = static_cast<uint8_t const*>(data);
+
+            for (size_t i = 0; i != size; ++i)
+            {
+                value = (value ^ bytes[i]) * 1099511628211ull;
+            }
+        }
+
+        void add(std::string_view const& text) noexcept
+        {
+            add_bytes(text.data(), text.size());
+            add_bytes("", 1);
+        }
+
+        void add(std::u16string_view const& text) noexcept
+        {
+            add_bytes(text.data(), text.size() * sizeof(char16_t));
+            add_bytes(u"", sizeof(char16_t));
+        }
+
+        template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T> || std::is_enum_v<T>>>
+        void add(T const number) noexcept
+        {
+            add_bytes(&number, sizeof(number));
+        }
+    };
+
+    inline void add_fingerprint(fingerprint& f, coded_index<TypeDefOrRef> const& type)
+    {
+        auto const [type_namespace, type_name] = get_type_namespace_and_name(type);
+        f.add(type_namespace);
+        f.add(type_name);
+
+        // The projection of a type depends on what kind of type it refers to, not just its name.
+        if (auto const type_def = find(type))
+        {
+            f.add(get_category(type_def));
+        }
+    }
+
+    inline void add_fingerprint(fingerprint& f, TypeSig const& signature)
+    {
+        f.add(signature.ptr_count());
+        f.add(signature.element_type());
+        f.add(signature.is_szarray());
+
+        if (signature.is_array())
+        {
+            for (auto&& size : signature.array_sizes())
+            {
+                f.add(size);
+            }
+        }
+
+        call(signature.Type(),
+            [&](ElementType type)
+            {
+                f.add(type);
+            },
+            [&](coded_index<TypeDefOrRef> const& type)
+            {
+                add_fingerprint(f, type);
+            },
+            [&](auto&&)
+            {
+                f.add(std::string_view{ "generic" });
+            });
+    }
+
+    inline void add_fingerprint(fingerprint& f, Constant const& constant)
+    {
+        f.add(constant.Type());
+
+        switch (constant.Type())
+        {
+        case ConstantType::UInt8: f.add(constant.ValueUInt8()); break;
+        case ConstantType::Int8: f.add(constant.ValueInt8()); break;
+        case ConstantType::UInt16: f.add(constant.ValueUInt16()); break;
+        case ConstantType::Int16: f.add(constant.ValueInt16()); break;
+        case ConstantType::UInt32: f.add(constant.ValueUInt32()); break;
+        case ConstantType::Int32: f.add(constant.ValueInt32()); break;
+        case ConstantType::UInt64: f.add(constant.ValueUInt64()); break;
+        case ConstantType::Int64: f.add(constant.ValueInt64()); break;
+        case ConstantType::Float32: f.add(constant.ValueFloat32()); break;
+        case ConstantType::Float64: f.add(constant.ValueFloat64()); break;
+        case ConstantType::String: f.add(constant.ValueString()); break;
+        default: break;
+        }
+    }
+
+    inline void add_fingerprint(fingerprint& f, MethodDef const& method)
+    {
+        method_signature signature{ method };
+        f.add(method.Name());
+        f.add(method.Flags().Access());
+        f.add(static_cast<bool>(signature.return_signature()));
+
+        if (signature.return_signature())
+        {
+            add_fingerprint(f, signature.return_signature().Type());
+        }
+
+        for (auto&& [param, param_signature] : signature.params())
+        {
+            f.add(param.Name());
+            add_fingerprint(f, param_signature->Type());
+
+            if (auto const attribute = get_attribute(param, "Windows.Win32.Interop", "RAIIFreeAttribute"))
+            {
+                f.add(std::get<std::string_view>(std::get<ElemSig>(attribute.Value().FixedArgs()[0].value).value));
+            }
+        }
+
+        // Large namespace headers are split by DLL.
+        if (settings.fragment_limit)
+        {
+            f.add(get_import_dll(method));
+        }
+    }
+
+    inline void add_fingerprint(fingerprint& f, TypeDef const& type)
+    {
+        f.add(type.TypeNamespace());
+        f.add(type.TypeName());
+        f.add(get_category(type));
+        f.add(type.Flags().Layout());
+        f.add(static_cast<bool>(get_attribute(type, "System", "FlagsAttribute")));
+
+        if (auto const attribute = get_attribute(type, "System.Runtime.InteropServices", "GuidAttribute"))
+        {
+            f.add(std::get<std::string_view>(std::get<ElemSig>(attribute.Value().FixedArgs()[0].value).value));
+        }
+
+        for (auto&& base : type.InterfaceImpl())
+        {
+            add_fingerprint(f, base.Interface());
+        }
+
+        for (auto&& field : type.FieldList())
+        {
+            f.add(field.Name());
+            add_fingerprint(f, field.Signature().Type());
+
+            if (field.Flags().Literal())
+            {
+                add_fingerprint(f, field.Constant());
+            }
+        }
+
+        for (auto&& method : type.MethodList())
+        {
+            add_fingerprint(f, method);
+        }
+
+        for (auto&& nested_type : type.get_cache().nested_types(type))
+        {
+            add_fingerprint(f, nested_type);
+        }
+    }
+
+    // Identifies the generator build. The version string alone is not bumped for every change to how headers
+    // are written, so the executable itself is hashed as well, once per run.
+    inline uint64_t get_generator_fingerprint()
+    {
+        static uint64_t const value = []
+        {
+            fingerprint f;
+            f.add(std::string_view{ CPPWIN32_VERSION_STRING });
+            file_view const file{ get_module_path() };
+            f.add_bytes(file.begin(), file.size());
+            return f.value;
+        }();
+
+        return value;
+    }
+
+    // Hashes everything the namespace headers are generated from: the namespace's own types, the names and
+    // kinds of the types they refer to, the generator build and the options that change the output. The
+    // projection fingerprint identifies the subset being projected when a root list is in use.
+    inline uint64_t get_namespace_fingerprint(std::string_view const& ns, cache::namespace_members const& members, uint64_t const projection = 0)
+    {
+        fingerprint f;
+        f.add(get_generator_fingerprint());
+        f.add(projection);
+        f.add(settings.license);
+        f.add(settings.brackets);
+        f.add(settings.modules);
+        f.add(settings.fragment_limit);
+        f.add(ns);
+
+        for (auto&& [name, type] : members.types)
+        {
+            add_fingerprint(f, type);
+        }
+
+        return f.value;
+    }
+
+    // Records the fingerprint of every namespace projected by the last successful run, so that namespaces
+    // whose inputs have not changed since can be skipped.
+    struct manifest
+    {
+        std::map<std::string, uint64_t, std::less<>> fingerprints;
+
+        static std::string path()
+        {
+            return settings.output_folder + "win32/impl/manifest.txt";
+        }
+
+        static manifest read()
+        {
+            manifest result;
+            std::ifstream file{ path() };
+            std::string ns;
+            uint64_t value{};
+
+            while (file >> std::hex >> value >> ns)
+            {
+                result.fingerprints[ns] = value;
+            }
+
+            return result;
+        }
+
+        void write() const
+        {
+            std::ofstream file{ path(), std::ios::out | std::ios::binary };
+
+            for (auto&& [ns, value] : fingerprints)
+            {
+                file << std::hex << value << ' ' << ns << '\n';
+            }
+
+            close_output(file, path());
+        }
+
+        bool is_current(std::string_view const& ns, uint64_t const value) const
+        {
+            auto it = fingerprints.find(ns);
+            return it != fingerprints.end() && it->second == value;
+        }
+    };
+
+    inline uint64_t get_content_hash(file_content const& content)
+    {
+        fingerprint f;
+
+        auto add = [&](std::string_view const& value)
+        {
+            f.add_bytes(value.data(), value.size());
+        };
+
+        content.first.for_each(add);
+
+        if (content.spill_size)
+        {
+            file_view const spill{ content.spill };
+            f.add_bytes(spill.begin(), spill.size());
+        }
+
+        content.second.for_each(add);
+        return f.value;
+    }
+
+    // Records the size, last write time and content hash of every output file. A file whose size and time
+    // still match its stamp, and whose stamp matches the hash of the new content, is known to be unchanged
+    // from a single stat without reading it back.
+    struct file_stamps
+    {
+        struct stamp
+        {
+            uint64_t hash{};
+            uint64_t size{};
+            int64_t time{};
+
+            bool operator==(stamp const& other) const noexcept
+            {
+                return hash == other.hash && size == other.size && time == other.time;
+            }
+        };
+
+        static std::string path()
+        {
+            return settings.output_folder + "win32/impl/stamps.txt";
+        }
+
+        void read()
+        {
+            std::ifstream file{ path() };
+            stamp value;
+            std::string filename;
+
+            while (file >> std::hex >> value.hash >> std::dec >> value.size >> value.time && std::getline(file >> std::ws, filename))
+            {
+                m_stamps[filename] = value;
+            }
+        }
+
+        void write() const
+        {
+            std::lock_guard lock{ m_lock };
+            std::ofstream file{ path(), std::ios::out | std::ios::binary };
+
+            for (auto&& [filename, value] : m_stamps)
+            {
+                file << std::hex << value.hash << ' ' << std::dec << value.size << ' ' << value.time << ' ' << filename << '\n';
+            }
+
+            close_output(file, path());
+        }
+
+        bool is_current(std::string const& filename, uint64_t const hash) const
+        {
+            stamp expected;
+
+            {
+                std::lock_guard lock{ m_lock };
+                auto it = m_stamps.find(filename);
+
+                if (it == m_stamps.end())
+                {
+                    return false;
+                }
+
+                expected = it->second;
+            }
+
+            stamp actual;
+            return expected.hash == hash && get_stamp(filename, hash, actual) && actual == expected;
+        }
+
+        // Called once the file on disk is known to hold the content with this hash.
+        void update(std::string const& filename, uint64_t const hash)
+        {
+            stamp value;
+
+            if (get_stamp(filename, hash, value))
+            {
+                std::lock_guard lock{ m_lock };
+                m_stamps[filename] = value;
+            }
+        }
+
+    private:
+
+        // A directory_entry fetches the size and the write time together.
+        static bool get_stamp(std::string const& filename, uint64_t const hash, stamp& value)
+        {
+            std::error_code error;
+            std::filesystem::directory_entry const entry{ filename, error };
+
+            if (error)
+            {
+                return false;
+            }
+
+            value.hash = hash;
+            value.size = entry.file_size(error);
+
+            if (error)
+            {
+                return false;
+            }
+
+            value.time = entry.last_write_time(error).time_since_epoch().count();
+            return !error;
+        }
+
+        std::map<std::string, stamp, std::less<>> m_stamps;
+        mutable std::mutex m_lock;
+    };
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "text_writer.h"
+#include "manifest.h"
+#include "profiler.h"
+
+namespace cppwin32
+{
+    // Compares and writes finished files on dedicated I/O threads so that formatting threads never wait on the
+    // disk. Files are handed over through a queue bounded by the number of bytes not yet written.
+    struct output_stage
+    {
+        using clock = std::chrono::steady_clock;
+
+        struct statistics
+        {
+            uint64_t files{};
+            uint64_t files_written{};
+            uint64_t files_unread{};
+            uint64_t bytes_written{};
+            clock::duration blocked{};
+            clock::duration queued{};
+            clock::duration writing{};
+        };
+
+        output_stage(output_stage const&) = delete;
+        output_stage& operator=(output_stage const&) = delete;
+
+        // When given file stamps, a file whose stamp shows it already holds the new content is not read back.
+        output_stage(uint32_t const threads, size_t const capacity, file_stamps* const stamps = nullptr) :
+            m_capacity(capacity),
+            m_stamps(stamps)
+        {
+            for (uint32_t i = 0; i != threads; ++i)
+            {
+                m_threads.emplace_back([this] { drain(); });
+            }
+        }
+
+        ~output_stage() noexcept
+        {
+            try
+            {
+                close();
+            }
+            catch (...)
+            {
+            }
+        }
+
+        // Only the buffered part of a file counts against the budget; text a writer spilled is already on disk.
+        void push(std::string filename, file_content content)
+        {
+            auto const size = content.first.size() + content.second.size();
+            auto const start = clock::now();
+            std::unique_lock lock{ m_lock };
+
+            // A file larger than the whole budget is still admitted once everything before it has been written.
+            m_not_full.wait(lock, [&] { return m_size == 0 || m_size + size <= m_capacity; });
+
+            auto const now = clock::now();
+            m_stats.blocked += now - start;
+            m_size += size;
+            m_files.push_back({ std::move(filename), std::move(content), now });
+            m_not_empty.notify_one();
+        }
+
+        // Waits for every queued file to be written and reports the first I/O failure, if any.
+        void close()
+        {
+            {
+                std::lock_guard lock{ m_lock };
+                m_closed = true;
+            }
+
+            m_not_empty.notify_all();
+
+            for (auto&& thread : m_threads)
+            {
+                thread.join();
+            }
+
+            m_threads.clear();
+
+            if (auto error = std::exchange(m_error, {}))
+            {
+                std::rethrow_exception(error);
+            }
+        }
+
+        statistics stats() const
+        {
+            std::lock_guard lock{ m_lock };
+            return m_stats;
+        }
+
+    private:
+
+        struct pending_file
+        {
+            std::string filename;
+            file_content content;
+            clock::time_point queued;
+        };
+
+        void drain()
+        {
+            while (true)
+            {
+                pending_file file;
+
+                {
+                    std::unique_lock lock{ m_lock };
+                    m_not_empty.wait(lock, [&] { return m_closed || !m_files.empty(); });
+
+                    if (m_files.empty())
+                    {
+                        return;
+                    }
+
+                    file = std::move(m_files.front());
+                    m_files.pop_front();
+                    m_stats.queued += clock::now() - file.queued;
+                }
+
+                auto const size = file.content.first.size() + file.content.second.size();
+                auto const start = clock::now();
+                std::exception_ptr error;
+                bool written{};
+                bool unread{};
+
+                try
+                {
+                    bool equal{};
+                    uint64_t hash{};
+
+                    if (m_stamps)
+                    {
+                        hash = get_content_hash(file.content);
+                        equal = unread = m_stamps->is_current(file.filename, hash);
+                    }
+
+                    if (!equal)
+                    {
+                        profile_span span{ "io", "file compare" };
+                        span.bytes(file.content.size());
+                        equal = file_equal(file.filename, file.content);
+                    }
+
+                    if (!equal)
+                    {
+                        profile_span span{ "io", "file write" };
+                        span.bytes(file.content.size());
+                        write_file(file.filename, file.content);
+                        written = true;
+                    }
+
+                    if (m_stamps && !unread)
+                    {
+                        m_stamps->update(file.filename, hash);
+                    }
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+
+                remove_spill(file.content);
+
+                auto const elapsed = clock::now() - start;
+
+                {
+                    std::lock_guard lock{ m_lock };
+                    m_size -= size;
+                    m_stats.writing += elapsed;
+                    ++m_stats.files;
+
+                    if (unread)
+                    {
+                        ++m_stats.files_unread;
+                    }
+
+                    if (written)
+                    {
+                        ++m_stats.files_written;
+                        m_stats.bytes_written += file.content.size();
+                    }
+
+                    if (error && !m_error)
+                    {
+                        m_error = error;
+                    }
+                }
+
+                m_not_full.notify_all();
+            }
+        }
+
+        size_t const m_capacity;
+        file_stamps* const m_stamps;
+        size_t m_size{};
+        bool m_closed{};
+        std::exception_ptr m_error;
+        statistics m_stats;
+        std::deque<pending_file> m_files;
+        mutable std::mutex m_lock;
+        std::condition_variable m_not_empty;
+        std::condition_variable m_not_full;
+        std::vector<std::thread> m_threads;
+    };
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "text_writer.h"
+
+namespace cppwin32
+{
+    // Collects timed spans and writes them out in the Chrome trace event format (chrome://tracing, Perfetto).
+    struct profiler
+    {
+        using clock = std::chrono::steady_clock;
+
+        struct event
+        {
+            std::string name;
+            std::string category;
+            uint32_t thread{};
+            clock::time_point start;
+            clock::time_point end;
+            uint64_t bytes{};
+        };
+
+        profiler(profiler const&) = delete;
+        profiler& operator=(profiler const&) = delete;
+
+        profiler() = default;
+
+        explicit profiler(clock::time_point const epoch) noexcept :
+            m_epoch(epoch)
+        {
+        }
+
+        // Small sequential numbers read far better than native thread ids in the trace viewer.
+        static uint32_t current_thread() noexcept
+        {
+            static std::atomic<uint32_t> next{};
+            thread_local uint32_t const id = ++next;
+            return id;
+        }
+
+        void add(event&& value)
+        {
+            std::lock_guard lock{ m_lock };
+            m_events.push_back(std::move(value));
+        }
+
+        void write(std::string const& filename) const
+        {
+            std::lock_guard lock{ m_lock };
+            std::ofstream file{ filename, std::ios::out | std::ios::binary };
+            file << "{\"traceEvents\":[\n";
+            bool first{ true };
+
+            for (auto&& value : m_events)
+            {
+                if (!first)
+                {
+                    file << ",\n";
+                }
+
+                first = false;
+                file << "{\"name\":\"";
+                write_escaped(file, value.name);
+                file << "\",\"cat\":\"";
+                write_escaped(file, value.category);
+                file << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << value.thread
+                    << ",\"ts\":" << microseconds(value.start - m_epoch)
+                    << ",\"dur\":" << microseconds(value.end - value.start)
+                    << ",\"args\":{\"bytes\":" << value.bytes << "}}";
+            }
+
+            file << "\n]}\n";
+            close_output(file, filename);
+        }
+
+    private:
+
+        static int64_t microseconds(clock::duration const duration) noexcept
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        }
+
+        static void write_escaped(std::ofstream& file, std::string_view const& value)
+        {
+            for (auto c : value)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    file << '\\';
+                }
+
+                file << c;
+            }
+        }
+
+        clock::time_point const m_epoch{ clock::now() };
+        std::vector<event> m_events;
+        mutable std::mutex m_lock;
+    };
+
+    // Records the lifetime of the guard as a span when profiling is enabled, and does nothing otherwise.
+    struct profile_span
+    {
+        profile_span(profile_span const&) = delete;
+        profile_span& operator=(profile_span const&) = delete;
+
+        profile_span(std::string_view const& category, std::string_view const& name) :
+            m_enabled(settings.profile != nullptr)
+        {
+            if (m_enabled)
+            {
+                m_event.category = category;
+                m_event.name = name;
+                m_event.thread = profiler::current_thread();
+                m_event.start = profiler::clock::now();
+            }
+        }
+
+        ~profile_span() noexcept
+        {
+            if (m_enabled)
+            {
+                try
+                {
+                    m_event.end = profiler::clock::now();
+                    settings.profile->add(std::move(m_event));
+                }
+                catch (...)
+                {
+                }
+            }
+        }
+
+        void bytes(uint64_t const value) noexcept
+        {
+            m_event.bytes = value;
+        }
+
+    private:
+
+        bool const m_enabled;
+        profiler::event m_event;
+    };
+}
@@ -2,6 +2,12 @@
 
 namespace cppwin32
 {
+    struct compile_report;
+    struct dependency_index;
+    struct output_stage;
+    struct profiler;
+    struct projection_roots;
+
     struct settings_type
     {
         std::set<std::string> input;
@@ -11,7 +17,12 @@ namespace cppwin32
         bool base{};
         bool license{};
         bool brackets{};
+        bool modules{};
         bool verbose{};
+        uint32_t jobs{};
+        uint64_t memory_budget{};
+        size_t spill_limit{};
+        uint64_t fragment_limit{};
         bool component{};
         std::string component_folder;
         std::string component_name;
@@ -28,6 +39,12 @@ namespace cppwin32
         winmd::reader::filter projection_filter;
         winmd::reader::filter component_filter;
 
+        output_stage* output{};
+        profiler* profile{};
+        compile_report* report{};
+        projection_roots const* roots{};
+        dependency_index const* dependencies{};
+
         bool fastabi{};
         std::map<winmd::reader::TypeDef, winmd::reader::TypeDef> fastabi_cache;
     };
@@ -0,0 +1,497 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <winmd_reader.h>
+#include "task_group.h"
+#include "type_closure.h"
+
+namespace cppwin32
+{
+    using namespace winmd::reader;
+
+    // The names a source file could be referring to the projection through. Identifiers are views into the
+    // mapped file, so the many that are not projected names cost no allocation. Qualified names are recorded
+    // with dots in place of :: and together with every prefix, so that win32::Windows::Win32::Dxgi::DXGI_FORMAT::X
+    // still finds the enum when the last part is an enumerator, but only where everything before the last
+    // part could name a metadata namespace.
+    struct source_names
+    {
+        std::set<std::string> usings;
+        std::unordered_set<std::string_view> identifiers;
+        std::unordered_set<std::string> qualified;
+
+        void merge(source_names&& other)
+        {
+            usings.merge(other.usings);
+            identifiers.merge(other.identifiers);
+            qualified.merge(other.qualified);
+        }
+    };
+
+    // Every metadata namespace together with each of its trailing parts, as in Windows.Win32.Graphics.Dxgi,
+    // Win32.Graphics.Dxgi, Graphics.Dxgi and Dxgi, since a name may be qualified relative to a using directive.
+    inline std::unordered_set<std::string_view> get_namespace_scopes(cache const& c)
+    {
+        std::unordered_set<std::string_view> scopes;
+
+        for (auto&& [ns, members] : c.namespaces())
+        {
+            for (size_t offset = 0; offset != std::string_view::npos; )
+            {
+                scopes.insert(ns.substr(offset));
+                offset = ns.find('.', offset);
+                offset = offset == std::string_view::npos ? offset : offset + 1;
+            }
+        }
+
+        return scopes;
+    }
+
+    inline bool is_identifier_start(char const c) noexcept
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+    }
+
+    inline bool is_identifier_char(char const c) noexcept
+    {
+        return is_identifier_start(c) || (c >= '0' && c <= '9');
+    }
+
+    // A deliberately small C++ lexer: it only has to step over comments and literals reliably and find
+    // identifier sequences joined by ::, which is all the scan needs.
+    struct source_lexer
+    {
+        explicit source_lexer(std::string_view const& text) noexcept :
+            m_first(text.data()),
+            m_last(text.data() + text.size())
+        {
+        }
+
+        // Reads the next qualified name split into its parts, returning false at the end of the text.
+        bool next(std::vector<std::string_view>& parts)
+        {
+            parts.clear();
+
+            while (m_first != m_last)
+            {
+                auto const c = *m_first;
+
+                if (c == '/' && peek(1) == '/')
+                {
+                    skip_line();
+                }
+                else if (c == '/' && peek(1) == '*')
+                {
+                    skip_block_comment();
+                }
+                else if (c == '"' || c == '\'')
+                {
+                    skip_literal(c);
+                }
+                else if (c >= '0' && c <= '9')
+                {
+                    // Also covers digit separators and suffixes, as in 1'000'000ull.
+                    while (m_first != m_last && (is_identifier_char(*m_first) || *m_first == '\'' || *m_first == '.'))
+                    {
+                        ++m_first;
+                    }
+                }
+                else if (is_identifier_start(c) || (c == ':' && peek(1) == ':'))
+                {
+                    if (read_qualified(parts))
+                    {
+                        return true;
+                    }
+                }
+                else
+                {
+                    ++m_first;
+                }
+            }
+
+            return false;
+        }
+
+    private:
+
+        char peek(size_t const offset) const noexcept
+        {
+            return static_cast<size_t>(m_last - m_first) > offset ? m_first[offset] : 0;
+        }
+
+        void skip_space() noexcept
+        {
+            while (m_first != m_last && (*m_first == ' ' || *m_first == '\t' || *m_first == '\r' || *m_first == '\n'))
+            {
+                ++m_first;
+            }
+        }
+
+        void skip_line() noexcept
+        {
+            while (m_first != m_last && *m_first != '\n')
+            {
+                ++m_first;
+            }
+        }
+
+        void skip_block_comment() noexcept
+        {
+            m_first += 2;
+
+            while (m_first != m_last && !(*m_first == '*' && peek(1) == '/'))
+            {
+                ++m_first;
+            }
+
+            m_first = m_first == m_last ? m_last : m_first + 2;
+        }
+
+        void skip_literal(char const quote) noexcept
+        {
+            ++m_first;
+
+            while (m_first != m_last && *m_first != quote && *m_first != '\n')
+            {
+                if (*m_first == '\\' && m_first + 1 != m_last)
+                {
+                    ++m_first;
+                }
+
+                ++m_first;
+            }
+
+            if (m_first != m_last)
+            {
+                ++m_first;
+            }
+        }
+
+        void skip_raw_literal() noexcept
+        {
+            auto const open = std::string_view{ m_first, static_cast<size_t>(m_last - m_first) }.find('(');
+
+            if (open == std::string_view::npos)
+            {
+                m_first = m_last;
+                return;
+            }
+
+            std::string closing{ ")" };
+            closing.append(m_first + 1, open - 1);
+            closing += '"';
+
+            auto const remaining = std::string_view{ m_first, static_cast<size_t>(m_last - m_first) };
+            auto const close = remaining.find(closing, open);
+            m_first = close == std::string_view::npos ? m_last : m_first + close + closing.size();
+        }
+
+        std::string_view read_identifier() noexcept
+        {
+            auto const first = m_first;
+
+            while (m_first != m_last && is_identifier_char(*m_first))
+            {
+                ++m_first;
+            }
+
+            return { first, static_cast<size_t>(m_first - first) };
+        }
+
+        bool read_qualified(std::vector<std::string_view>& parts)
+        {
+            if (*m_first == ':')
+            {
+                m_first += 2;
+                skip_space();
+
+                if (m_first == m_last || !is_identifier_start(*m_first))
+                {
+                    return false;
+                }
+            }
+
+            while (true)
+            {
+                auto const part = read_identifier();
+
+                if (parts.empty() && m_first != m_last && *m_first == '"' && (part == "R" || part == "LR" || part == "uR" || part == "UR" || part == "u8R"))
+                {
+                    skip_raw_literal();
+                    return false;
+                }
+
+                parts.push_back(part);
+                auto const restore = m_first;
+                skip_space();
+
+                if (m_first != m_last && *m_first == ':' && peek(1) == ':')
+                {
+                    m_first += 2;
+                    skip_space();
+
+                    if (m_first != m_last && is_identifier_start(*m_first))
+                    {
+                        continue;
+                    }
+                }
+
+                m_first = restore;
+                return true;
+            }
+        }
+
+        char const* m_first;
+        char const* const m_last;
+    };
+
+    inline std::string join_parts(std::vector<std::string_view> const& parts, size_t const count)
+    {
+        std::string result{ parts[0] };
+
+        for (size_t i = 1; i != count; ++i)
+        {
+            result += '.';
+            result += parts[i];
+        }
+
+        return result;
+    }
+
+    inline void scan_source(std::string_view const& text, std::unordered_set<std::string_view> const& scopes, source_names& result)
+    {
+        source_lexer lexer{ text };
+        std::vector<std::string_view> parts;
+        std::string scope;
+        bool after_using{};
+        bool after_using_namespace{};
+
+        while (lexer.next(parts))
+        {
+            if (after_using_namespace && parts[0] == "win32")
+            {
+                result.usings.insert(join_parts(parts, parts.size()));
+            }
+
+            after_using_namespace = after_using && parts.size() == 1 && parts[0] == "namespace";
+            after_using = parts.size() == 1 && parts[0] == "using";
+            result.identifiers.insert(parts[0]);
+            scope.clear();
+
+            for (size_t count = 2; count <= parts.size(); ++count)
+            {
+                if (count != 2 || parts[0] != "win32")
+                {
+                    if (!scope.empty())
+                    {
+                        scope += '.';
+                    }
+
+                    scope += parts[count - 2];
+                }
+
+                if (scopes.find(scope) != scopes.end())
+                {
+                    result.qualified.insert(join_parts(parts, count));
+                }
+            }
+        }
+    }
+
+    // The functions and constants of a namespace by name, built only for the namespaces the sources name.
+    struct namespace_apis
+    {
+        std::unordered_map<std::string_view, MethodDef> methods;
+        std::unordered_map<std::string_view, Field> fields;
+    };
+
+    struct source_resolver
+    {
+        source_resolver(cache const& c, projection_roots& roots, std::vector<TypeDef>& found) :
+            m_cache(c),
+            m_roots(roots),
+            m_found(found)
+        {
+        }
+
+        bool resolve(std::string_view const& name)
+        {
+            auto const dot = name.rfind('.');
+
+            if (dot == std::string_view::npos)
+            {
+                return false;
+            }
+
+            auto const ns = name.substr(0, dot);
+            auto const member = name.substr(dot + 1);
+
+            if (auto const type = m_cache.find(ns, member))
+            {
+                m_found.push_back(type);
+                return true;
+            }
+
+            auto const apis = get_apis(ns);
+
+            if (!apis)
+            {
+                return false;
+            }
+
+            if (auto const method = apis->methods.find(member); method != apis->methods.end())
+            {
+                m_roots.methods.insert(method->second);
+                add_closure_edges(method->second, m_found);
+                return true;
+            }
+
+            if (auto const field = apis->fields.find(member); field != apis->fields.end())
+            {
+                m_roots.fields.insert(field->second);
+                return true;
+            }
+
+            return false;
+        }
+
+    private:
+
+        namespace_apis const* get_apis(std::string_view const& ns)
+        {
+            auto const members = m_cache.namespaces().find(ns);
+
+            if (members == m_cache.namespaces().end())
+            {
+                return nullptr;
+            }
+
+            auto [apis, inserted] = m_apis.try_emplace(members->first);
+
+            if (inserted)
+            {
+                for (auto&& type : members->second.classes)
+                {
+                    for (auto&& method : type.MethodList())
+                    {
+                        apis->second.methods.emplace(method.Name(), method);
+                    }
+
+                    for (auto&& field : type.FieldList())
+                    {
+                        apis->second.fields.emplace(field.Name(), field);
+                    }
+                }
+            }
+
+            return &apis->second;
+        }
+
+        cache const& m_cache;
+        projection_roots& m_roots;
+        std::vector<TypeDef>& m_found;
+        std::map<std::string_view, namespace_apis> m_apis;
+    };
+
+    inline bool is_source_file(std::filesystem::path const& path)
+    {
+        static constexpr std::string_view extensions[]{ ".h", ".hh", ".hpp", ".hxx", ".inl", ".ipp", ".c", ".cc", ".cpp", ".cxx", ".ixx", ".cppm" };
+        auto const extension = path.extension().string();
+
+        return std::any_of(std::begin(extensions), std::end(extensions), [&](std::string_view const& candidate)
+            {
+                return extension.size() == candidate.size() && std::equal(extension.begin(), extension.end(), candidate.begin(), [](char left, char right)
+                    {
+                        return std::tolower(static_cast<unsigned char>(left)) == right;
+                    });
+            });
+    }
+
+    // Adds whatever the C++ sources under a folder refer to through the win32 namespace to the roots. Files
+    // are memory mapped and lexed in parallel. The using directives of every file are applied to the names of
+    // every file, since a directive in a shared header reaches all of its includers; that may pull in a few
+    // extra types but never leaves out one that is used.
+    inline void scan_sources(cache const& c, std::string const& folder, projection_roots& roots, std::vector<TypeDef>& found)
+    {
+        if (!std::filesystem::is_directory(folder))
+        {
+            throw_invalid("Could not scan sources in '", folder, "'");
+        }
+
+        std::vector<std::filesystem::path> files;
+        std::vector<uint64_t> sizes;
+
+        for (auto&& entry : std::filesystem::recursive_directory_iterator(folder, std::filesystem::directory_options::skip_permission_denied))
+        {
+            if (entry.is_regular_file() && is_source_file(entry.path()) && entry.file_size() != 0)
+            {
+                files.push_back(entry.path());
+                sizes.push_back(entry.file_size());
+            }
+        }
+
+        auto const scopes = get_namespace_scopes(c);
+        std::vector<std::unique_ptr<file_view>> views(files.size());
+        std::vector<source_names> results(files.size());
+
+        {
+            task_group group{ settings.jobs };
+
+            for (size_t i = 0; i != files.size(); ++i)
+            {
+                group.add([&, i]
+                    {
+                        views[i] = std::make_unique<file_view>(files[i].string());
+                        scan_source({ reinterpret_cast<char const*>(views[i]->begin()), views[i]->size() }, scopes, results[i]);
+                    }, sizes[i]);
+            }
+
+            group.get();
+        }
+
+        // The identifiers still point into the views, which stay mapped until the names are resolved.
+        source_names all;
+
+        for (auto&& result : results)
+        {
+            all.merge(std::move(result));
+        }
+
+        // Sorted so that the types found come out in the same order on every run.
+        std::vector<std::string_view> names{ all.identifiers.begin(), all.identifiers.end() };
+        names.insert(names.end(), all.qualified.begin(), all.qualified.end());
+        std::sort(names.begin(), names.end());
+
+        source_resolver resolver{ c, roots, found };
+        std::string_view const prefix{ "win32." };
+
+        for (auto&& name : names)
+        {
+            if (name.substr(0, prefix.size()) == prefix)
+            {
+                resolver.resolve(name.substr(prefix.size()));
+                continue;
+            }
+
+            for (auto&& ns : all.usings)
+            {
+                auto const qualified = ns.size() > prefix.size() ? ns.substr(prefix.size()) + '.' + std::string{ name } : std::string{ name };
+
+                if (resolver.resolve(qualified))
+                {
+                    break;
+                }
+            }
+        }
+    }
+}
@@ -1,29 +1,45 @@
 #pragma once
 
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 namespace cppwin32
 {
+    // Runs a batch of tasks on a bounded set of worker threads. Tasks are queued with an estimated cost
+    // and only start when get() is called, so the whole batch can be ordered largest first and dealt out
+    // to per-worker queues. A worker whose queue runs dry steals from the front of another worker's queue.
     struct task_group
     {
         task_group(task_group const&) = delete;
         task_group& operator=(task_group const&) = delete;
 
-        task_group() noexcept = default;
-
-        ~task_group() noexcept
+        explicit task_group(uint32_t jobs = 0) noexcept :
+            m_jobs(jobs ? jobs : (std::max)(1u, std::thread::hardware_concurrency()))
         {
-            for (auto&& task : m_tasks)
-            {
-                task.wait();
-            }
         }
 
+        // Tasks still pending are discarded, not run. A group is only destroyed before get() when an
+        // exception is already unwinding the stack, and running the batch then would hide that error.
+        ~task_group() = default;
+
         template <typename T>
-        void add(T&& callback)
+        void add(T&& callback, uint64_t cost = 0)
         {
 #if defined(_DEBUG)
             callback();
 #else
-            m_tasks.push_back(std::async(std::forward<T>(callback)));
+            if (m_jobs == 1)
+            {
+                callback();
+                return;
+            }
+
+            m_tasks.push_back({ std::forward<T>(callback), cost });
 #endif
         }
 
@@ -31,19 +47,117 @@ namespace cppwin32
         {
             auto tasks = std::move(m_tasks);
 
-            for (auto&& task : tasks)
+            if (tasks.empty())
+            {
+                return;
+            }
+
+            std::stable_sort(tasks.begin(), tasks.end(), [](task const& left, task const& right)
+                {
+                    return left.cost > right.cost;
+                });
+
+            auto const count = (std::min)(static_cast<size_t>(m_jobs), tasks.size());
+            std::vector<worker_queue> queues(count);
+
+            for (size_t i = 0; i != tasks.size(); ++i)
+            {
+                queues[i % count].tasks.push_back(&tasks[i]);
+            }
+
+            std::mutex error_lock;
+            std::exception_ptr error;
+
+            auto work = [&](size_t const self)
+            {
+                while (auto current = next_task(queues, self))
+                {
+                    try
+                    {
+                        current->callback();
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard guard{ error_lock };
+
+                        if (!error)
+                        {
+                            error = std::current_exception();
+                        }
+                    }
+                }
+            };
+
+            std::vector<std::thread> threads;
+            threads.reserve(count - 1);
+
+            for (size_t i = 1; i != count; ++i)
+            {
+                threads.emplace_back(work, i);
+            }
+
+            work(0);
+
+            for (auto&& thread : threads)
             {
-                task.wait();
+                thread.join();
             }
 
-            for (auto&& task : tasks)
+            if (error)
             {
-                task.get();
+                std::rethrow_exception(error);
             }
         }
 
     private:
 
-        std::vector<std::future<void>> m_tasks;
+        struct task
+        {
+            std::function<void()> callback;
+            uint64_t cost{};
+        };
+
+        struct worker_queue
+        {
+            std::mutex lock;
+            std::deque<task*> tasks;
+        };
+
+        // No tasks are added once a batch is running, so finding every queue empty means the batch is done.
+        // Each queue holds its tasks largest first. The owner and a thief both take from the front, so the
+        // most expensive remaining task is always started next, and no large task is left behind to run
+        // alone at the end of the batch.
+        static task* next_task(std::vector<worker_queue>& queues, size_t const self)
+        {
+            {
+                auto& queue = queues[self];
+                std::lock_guard guard{ queue.lock };
+
+                if (!queue.tasks.empty())
+                {
+                    auto result = queue.tasks.front();
+                    queue.tasks.pop_front();
+                    return result;
+                }
+            }
+
+            for (size_t offset = 1; offset != queues.size(); ++offset)
+            {
+                auto& victim = queues[(self + offset) % queues.size()];
+                std::lock_guard guard{ victim.lock };
+
+                if (!victim.tasks.empty())
+                {
+                    auto result = victim.tasks.front();
+                    victim.tasks.pop_front();
+                    return result;
+                }
+            }
+
+            return nullptr;
+        }
+
+        uint32_t m_jobs{};
+        std::vector<task> m_tasks;
     };
 }
@@ -1,12 +1,23 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <charconv>
+#include <cstring>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <winmd_reader.h>
 
 namespace cppwin32
 {
@@ -16,15 +27,479 @@ namespace cppwin32
         return static_cast<std::stringstream const&>(std::stringstream() << file.rdbuf()).str();
     }
 
+    // Closing flushes what is still buffered, so a full disk is only certain to show up afterwards. A file
+    // cut short must fail the run, since a manifest or stamp file could otherwise mark output current that
+    // was never written.
+    inline void close_output(std::ofstream& file, std::string const& filename)
+    {
+        file.close();
+
+        if (!file)
+        {
+            throw std::runtime_error("Could not write '" + filename + "'");
+        }
+    }
+
+    // Hands out the fixed-size blocks text buffers are built from. Writers acquire blocks on worker threads but
+    // the output stage releases them on its I/O threads, so released blocks go to free lists shared by all
+    // threads. The lists are split into shards to keep threads from contending for one lock: each thread
+    // starts at its own shard and moves on to the others when it finds that one empty, or full on release.
+    struct text_chunk_pool
+    {
+        static constexpr size_t chunk_size = 64 * 1024;
+        static constexpr size_t shard_count = 8;
+        static constexpr size_t max_free = 16;
+
+        static std::unique_ptr<char[]> acquire()
+        {
+            auto const first = home_shard();
+
+            for (size_t offset = 0; offset != shard_count; ++offset)
+            {
+                auto& shard = shards()[(first + offset) % shard_count];
+                std::lock_guard lock{ shard.lock };
+
+                if (!shard.chunks.empty())
+                {
+                    auto result = std::move(shard.chunks.back());
+                    shard.chunks.pop_back();
+                    return result;
+                }
+            }
+
+            return std::make_unique<char[]>(chunk_size);
+        }
+
+        static void release(std::unique_ptr<char[]>&& chunk) noexcept
+        {
+            auto const first = home_shard();
+
+            for (size_t offset = 0; offset != shard_count; ++offset)
+            {
+                auto& shard = shards()[(first + offset) % shard_count];
+                std::lock_guard lock{ shard.lock };
+
+                if (shard.chunks.size() < max_free)
+                {
+                    // The capacity is reserved up front, so this never allocates and cannot throw.
+                    shard.chunks.push_back(std::move(chunk));
+                    return;
+                }
+            }
+
+            chunk.reset();
+        }
+
+    private:
+
+        struct shard
+        {
+            shard()
+            {
+                chunks.reserve(max_free);
+            }
+
+            std::mutex lock;
+            std::vector<std::unique_ptr<char[]>> chunks;
+        };
+
+        static std::array<shard, shard_count>& shards() noexcept
+        {
+            static std::array<shard, shard_count> shards;
+            return shards;
+        }
+
+        static size_t home_shard() noexcept
+        {
+            static std::atomic<size_t> next;
+            thread_local size_t const shard = next++ % shard_count;
+            return shard;
+        }
+    };
+
+    // Text kept as a list of fixed-size chunks, so that it never has to be copied to grow.
+    struct text_buffer
+    {
+        text_buffer(text_buffer const&) = delete;
+        text_buffer& operator=(text_buffer const&) = delete;
+
+        text_buffer() = default;
+
+        text_buffer(text_buffer&& other) noexcept :
+            m_chunks(std::exchange(other.m_chunks, {})),
+            m_size(std::exchange(other.m_size, 0))
+        {
+        }
+
+        text_buffer& operator=(text_buffer&& other) noexcept
+        {
+            if (this != &other)
+            {
+                clear();
+                m_chunks = std::exchange(other.m_chunks, {});
+                m_size = std::exchange(other.m_size, 0);
+            }
+
+            return *this;
+        }
+
+        ~text_buffer() noexcept
+        {
+            clear();
+        }
+
+        void append(std::string_view value)
+        {
+            while (!value.empty())
+            {
+                auto const count = (std::min)(value.size(), reserve());
+                std::memcpy(m_chunks.back().data.get() + m_chunks.back().size, value.data(), count);
+                m_chunks.back().size += count;
+                m_size += count;
+                value.remove_prefix(count);
+            }
+        }
+
+        void push_back(char const value)
+        {
+            reserve();
+            m_chunks.back().data[m_chunks.back().size++] = value;
+            ++m_size;
+        }
+
+        size_t size() const noexcept
+        {
+            return m_size;
+        }
+
+        bool empty() const noexcept
+        {
+            return m_size == 0;
+        }
+
+        char back() const noexcept
+        {
+            assert(!empty());
+            return m_chunks.back().data[m_chunks.back().size - 1];
+        }
+
+        void clear() noexcept
+        {
+            for (auto&& chunk : m_chunks)
+            {
+                text_chunk_pool::release(std::move(chunk.data));
+            }
+
+            m_chunks.clear();
+            m_size = 0;
+        }
+
+        // Drops everything past the given size.
+        void truncate(size_t const size) noexcept
+        {
+            while (m_size > size)
+            {
+                auto& chunk = m_chunks.back();
+                auto const count = (std::min)(chunk.size, m_size - size);
+                chunk.size -= count;
+                m_size -= count;
+
+                if (!chunk.size)
+                {
+                    text_chunk_pool::release(std::move(chunk.data));
+                    m_chunks.pop_back();
+                }
+            }
+        }
+
+        // Replaces the target's content with everything from the offset on, reusing the target's storage.
+        void copy_to(size_t offset, std::string& target) const
+        {
+            target.clear();
+
+            for_each([&](std::string_view const& value)
+                {
+                    auto const skip = (std::min)(offset, value.size());
+                    target.append(value.substr(skip));
+                    offset -= skip;
+                });
+        }
+
+        template <typename F>
+        void for_each(F&& f) const
+        {
+            for (auto&& chunk : m_chunks)
+            {
+                f(std::string_view{ chunk.data.get(), chunk.size });
+            }
+        }
+
+    private:
+
+        struct chunk
+        {
+            std::unique_ptr<char[]> data;
+            size_t size{};
+        };
+
+        // Returns the room left in the last chunk, adding a chunk when it is full.
+        size_t reserve()
+        {
+            if (m_chunks.empty() || m_chunks.back().size == text_chunk_pool::chunk_size)
+            {
+                m_chunks.push_back({ text_chunk_pool::acquire() });
+            }
+
+            return text_chunk_pool::chunk_size - m_chunks.back().size;
+        }
+
+        std::vector<chunk> m_chunks;
+        size_t m_size{};
+    };
+
+    // The content of a generated file. Writers that spill to disk keep the text that goes between first and
+    // second in a temporary file instead of in memory.
+    struct file_content
+    {
+        text_buffer first;
+        std::string spill;
+        uint64_t spill_size{};
+        text_buffer second;
+
+        uint64_t size() const noexcept
+        {
+            return first.size() + spill_size + second.size();
+        }
+    };
+
+    // Files of a different size are told apart from a stat alone. Otherwise both the old file and any spilled
+    // text are mapped and compared in place rather than read into memory.
+    inline bool file_equal(std::string const& filename, file_content const& content)
+    {
+        std::error_code error;
+        auto const size = std::filesystem::file_size(filename, error);
+
+        if (error || size != content.size())
+        {
+            return false;
+        }
+
+        if (!size)
+        {
+            return true;
+        }
+
+        winmd::reader::file_view const file{ filename };
+        auto position = file.begin();
+
+        bool equal{ true };
+
+        auto compare = [&](std::string_view const& value)
+        {
+            equal = equal && 0 == std::memcmp(position, value.data(), value.size());
+            position += value.size();
+        };
+
+        content.first.for_each(compare);
+
+        if (content.spill_size)
+        {
+            winmd::reader::file_view const spill{ content.spill };
+
+            if (!equal || spill.size() != content.spill_size)
+            {
+                return false;
+            }
+
+            compare({ reinterpret_cast<char const*>(spill.begin()), spill.size() });
+        }
+
+        content.second.for_each(compare);
+        return equal;
+    }
+
+    // Throws if any part of the file could not be written, including what is only flushed when it is closed.
+    inline void write_file(std::string const& filename, file_content const& content)
+    {
+        std::ofstream file{ filename, std::ios::out | std::ios::binary };
+
+        if (!file)
+        {
+            throw std::runtime_error("Could not open '" + filename + "' for writing");
+        }
+
+        auto write = [&](std::string_view const& value)
+        {
+            file.write(value.data(), value.size());
+        };
+
+        content.first.for_each(write);
+
+        if (content.spill_size)
+        {
+            std::ifstream spill{ content.spill, std::ios::binary };
+            auto const start = file.tellp();
+            file << spill.rdbuf();
+
+            // A short copy leaves the stream good, so the length is checked as well.
+            if (file.tellp() - start != static_cast<std::streamoff>(content.spill_size))
+            {
+                file.setstate(std::ios::failbit);
+            }
+        }
+
+        content.second.for_each(write);
+        close_output(file, filename);
+    }
+
+    inline void remove_spill(file_content const& content) noexcept
+    {
+        if (!content.spill.empty())
+        {
+            std::error_code ignored;
+            std::filesystem::remove(content.spill, ignored);
+        }
+    }
+
+    // Writes the file unless it already holds exactly this content. Returns whether the file was written.
+    inline bool flush_to_file(std::string const& filename, file_content const& content)
+    {
+        bool written{};
+
+        if (!file_equal(filename, content))
+        {
+            write_file(filename, content);
+            written = true;
+        }
+
+        remove_spill(content);
+        return written;
+    }
+
+    // A run of literal text in a format_string, or a placeholder for one of its arguments.
+    struct format_segment
+    {
+        char kind{};
+        uint32_t offset{};
+        uint32_t length{};
+        uint32_t arg{};
+    };
+
+    // A format string checked at compile time. Declare it as a static constexpr local and pass it as a
+    // template argument to write. Only the text and the segment count are stored here; the segments are
+    // held by format_segments, sized to that count, because a format has far fewer segments than characters.
+    template <size_t N>
+    struct format_string
+    {
+        char text[N]{};
+        uint32_t count{};
+        uint32_t placeholders{};
+
+        constexpr format_string(char const(&value)[N])
+        {
+            for (size_t i = 0; i != N; ++i)
+            {
+                text[i] = value[i];
+            }
+
+            parse([&](format_segment const& segment)
+                {
+                    ++count;
+                    placeholders += segment.kind != 0;
+                });
+        }
+
+        // Calls back with each segment in order. An escape ends the literal segment before it, and the
+        // character it escapes starts the next one.
+        template <typename Callback>
+        constexpr void parse(Callback&& callback) const
+        {
+            format_segment literal{};
+            uint32_t arg{};
+
+            auto end_literal = [&]
+            {
+                if (literal.length)
+                {
+                    callback(literal);
+                    literal.length = 0;
+                }
+            };
+
+            for (size_t i = 0; i + 1 < N; ++i)
+            {
+                auto const c = text[i];
+
+                if (c == '%' || c == '@')
+                {
+                    end_literal();
+                    callback(format_segment{ c, 0, 0, arg++ });
+                    continue;
+                }
+
+                if (c == '^')
+                {
+                    // Throwing makes the constant evaluation fail, so this is a compile-time error.
+                    if (i + 2 == N)
+                    {
+                        throw std::invalid_argument("A format string cannot end with an escape.");
+                    }
+
+                    end_literal();
+                    ++i;
+                }
+
+                if (!literal.length)
+                {
+                    literal.offset = static_cast<uint32_t>(i);
+                }
+
+                ++literal.length;
+            }
+
+            end_literal();
+        }
+    };
+
+    template <auto const& Format>
+    inline constexpr auto format_segments = []
+    {
+        std::array<format_segment, Format.count> result{};
+        size_t count{};
+
+        Format.parse([&](format_segment const& segment)
+            {
+                result[count++] = segment;
+            });
+
+        return result;
+    }();
+
     template <typename T>
     struct writer_base
     {
         writer_base(writer_base const&) = delete;
         writer_base& operator=(writer_base const&) = delete;
 
-        writer_base()
+        writer_base() = default;
+
+        ~writer_base() noexcept
+        {
+            if (!m_spill.empty())
+            {
+                m_spill_file.close();
+                std::error_code ignored;
+                std::filesystem::remove(m_spill, ignored);
+            }
+        }
+
+        // Bounds the memory a large file needs: once the body grows past the limit it is moved to a temporary
+        // file in the given folder. The preamble written after swap() is still buffered and is stitched back
+        // in front of the spilled body when the file is flushed.
+        void spill_to(std::string folder, size_t const limit)
         {
-            m_first.reserve(16 * 1024);
+            m_spill_folder = std::move(folder);
+            m_spill_limit = limit;
         }
 
         template <typename... Args>
@@ -38,30 +513,40 @@ namespace cppwin32
             write_segment(value, args...);
         }
 
+        template <auto const& Format, typename... Args>
+        void write(Args const&... args)
+        {
+            static_assert(Format.placeholders == sizeof...(Args), "The number of arguments does not match the format string.");
+            write_format<Format>(std::make_index_sequence<Format.count>{}, std::forward_as_tuple(args...));
+        }
+
         template <typename... Args>
         std::string write_temp(std::string_view const& value, Args const&... args)
         {
-#if defined(_DEBUG)
-            bool restore_debug_trace = debug_trace;
-            debug_trace = false;
-#endif
-            auto const size = m_first.size();
+            return std::string{ write_scratch(value, args...) };
+        }
 
+        // Formats into the writer's own buffer and returns a view of the result held in reusable scratch
+        // storage, so once that storage has grown nothing is allocated. The view is only valid until the
+        // next call.
+        template <typename... Args>
+        std::string_view write_scratch(std::string_view const& value, Args const&... args)
+        {
+            scratch_guard guard{ this };
             assert(count_placeholders(value) == sizeof...(Args));
             write_segment(value, args...);
-
-            std::string result{ m_first.data() + size, m_first.size() - size };
-            m_first.resize(size);
-
-#if defined(_DEBUG)
-            debug_trace = restore_debug_trace;
-#endif
-            return result;
+            m_first.copy_to(guard.size, m_scratch);
+            return m_scratch;
         }
 
         void write_impl(std::string_view const& value)
         {
-            m_first.insert(m_first.end(), value.begin(), value.end());
+            m_first.append(value);
+
+            if (m_first.size() > m_spill_limit && !m_temp_depth && !m_swapped)
+            {
+                spill();
+            }
 
 #if defined(_DEBUG)
             if (debug_trace)
@@ -106,22 +591,22 @@ namespace cppwin32
 
         void write(int32_t const value)
         {
-            write(std::to_string(value));
+            write_integer(value);
         }
 
         void write(uint32_t const value)
         {
-            write(std::to_string(value));
+            write_integer(value);
         }
 
         void write(int64_t const value)
         {
-            write(std::to_string(value));
+            write_integer(value);
         }
 
         void write(uint64_t const value)
         {
-            write(std::to_string(value));
+            write_integer(value);
         }
 
         template <typename... Args>
@@ -144,26 +629,25 @@ namespace cppwin32
         void swap() noexcept
         {
             std::swap(m_second, m_first);
+            m_swapped = true;
         }
 
         void flush_to_console(bool to_stdout = true) noexcept
         {
-            fprintf(to_stdout ? stdout : stderr, "%.*s", static_cast<int>(m_first.size()), m_first.data());
-            fprintf(to_stdout ? stdout : stderr, "%.*s", static_cast<int>(m_second.size()), m_second.data());
+            auto print = [stream = to_stdout ? stdout : stderr](std::string_view const& value)
+            {
+                fprintf(stream, "%.*s", static_cast<int>(value.size()), value.data());
+            };
+
+            m_first.for_each(print);
+            m_second.for_each(print);
             m_first.clear();
             m_second.clear();
         }
 
         void flush_to_file(std::string const& filename)
         {
-            if (!file_equal(filename))
-            {
-                std::ofstream file{ filename, std::ios::out | std::ios::binary };
-                file.write(m_first.data(), m_first.size());
-                file.write(m_second.data(), m_second.size());
-            }
-            m_first.clear();
-            m_second.clear();
+            cppwin32::flush_to_file(filename, release());
         }
 
         void flush_to_file(std::filesystem::path const& filename)
@@ -173,40 +657,79 @@ namespace cppwin32
 
         std::string flush_to_string()
         {
+            if (!m_spill_size)
+            {
+                std::string result;
+                result.reserve(m_first.size() + m_second.size());
+                auto append = [&](std::string_view const& value) { result.append(value); };
+                m_first.for_each(append);
+                m_second.for_each(append);
+                m_first.clear();
+                m_second.clear();
+                return result;
+            }
+
+            auto const content = release();
             std::string result;
-            result.reserve(m_first.size() + m_second.size());
-            result.assign(m_first.begin(), m_first.end());
-            result.append(m_second.begin(), m_second.end());
-            m_first.clear();
-            m_second.clear();
+            result.reserve(static_cast<size_t>(content.size()));
+            auto append = [&](std::string_view const& value) { result.append(value); };
+            content.first.for_each(append);
+            result += file_to_string(content.spill);
+            content.second.for_each(append);
+            remove_spill(content);
             return result;
         }
 
-        char back()
+        uint64_t size() const noexcept
         {
-            return m_first.empty() ? char{} : m_first.back();
+            return m_first.size() + m_spill_size + m_second.size();
         }
 
-        bool file_equal(std::string const& filename) const
+        // Hands the content over to the caller, including any spilled body, and leaves the writer empty.
+        file_content release()
         {
-            if (!std::filesystem::exists(filename))
+            file_content result;
+
+            if (!m_spill.empty())
             {
-                return false;
-            }
+                m_spill_file.close();
+
+                if (!m_spill_file)
+                {
+                    throw std::runtime_error("Could not write '" + m_spill + "'");
+                }
 
-            auto file = file_to_string(filename);
+                result.spill = std::move(m_spill);
+                result.spill_size = std::exchange(m_spill_size, 0);
+                m_spill.clear();
+            }
 
-            if (file.size() != m_first.size() + m_second.size())
+            // Text spilled before swap() is the start of the body, which only follows the buffer once the
+            // preamble has been swapped in front of it.
+            if (m_swapped)
             {
-                return false;
+                result.first = std::move(m_first);
+                result.second = std::move(m_second);
+            }
+            else
+            {
+                result.second = std::move(m_first);
             }
 
-            if (!std::equal(m_first.begin(), m_first.end(), file.begin(), file.begin() + m_first.size()))
+            m_first.clear();
+            m_second.clear();
+            m_swapped = false;
+            return result;
+        }
+
+        char back()
+        {
+            if (m_first.empty())
             {
-                return false;
+                return m_swapped ? char{} : m_spill_back;
             }
 
-            return std::equal(m_second.begin(), m_second.end(), file.begin() + m_first.size(), file.end());
+            return m_first.back();
         }
 
 #if defined(_DEBUG)
@@ -252,7 +775,10 @@ namespace cppwin32
 
             write(value.substr(0, offset));
 
-            assert(offset != value.size() - 1);
+            if (offset == value.size() - 1)
+            {
+                throw std::invalid_argument("A format string cannot end with an escape.");
+            }
 
             write(value[offset + 1]);
             write_segment(value.substr(offset + 2));
@@ -262,12 +788,20 @@ namespace cppwin32
         void write_segment(std::string_view const& value, First const& first, Rest const&... rest)
         {
             auto offset = value.find_first_of("^%@");
-            assert(offset != std::string_view::npos);
+
+            if (offset == std::string_view::npos)
+            {
+                throw std::invalid_argument("A format string has fewer placeholders than arguments.");
+            }
+
             write(value.substr(0, offset));
 
             if (value[offset] == '^')
             {
-                assert(offset != value.size() - 1);
+                if (offset == value.size() - 1)
+                {
+                    throw std::invalid_argument("A format string cannot end with an escape.");
+                }
 
                 write(value[offset + 1]);
                 write_segment(value.substr(offset + 2), first, rest...);
@@ -294,8 +828,102 @@ namespace cppwin32
             }
         }
 
-        std::vector<char> m_second;
-        std::vector<char> m_first;
+        template <typename Integer>
+        void write_integer(Integer const value)
+        {
+            char buffer[24];
+            auto const end = std::to_chars(std::begin(buffer), std::end(buffer), value).ptr;
+            write(std::string_view{ buffer, static_cast<size_t>(end - buffer) });
+        }
+
+        template <auto const& Format, size_t... Segments, typename Args>
+        void write_format(std::index_sequence<Segments...>, Args const& args)
+        {
+            (write_format_segment<Format, Segments>(args), ...);
+        }
+
+        template <auto const& Format, size_t Segment, typename Args>
+        void write_format_segment(Args const& args)
+        {
+            constexpr auto segment = format_segments<Format>[Segment];
+
+            if constexpr (segment.kind == '%')
+            {
+                static_cast<T*>(this)->write(std::get<segment.arg>(args));
+            }
+            else if constexpr (segment.kind == '@')
+            {
+                static_assert(std::is_convertible_v<std::tuple_element_t<segment.arg, Args>, std::string_view>, "'@' placeholders are only for text.");
+                static_cast<T*>(this)->write_code(std::get<segment.arg>(args));
+            }
+            else
+            {
+                write(std::string_view{ Format.text + segment.offset, segment.length });
+            }
+        }
+
+        void spill()
+        {
+            if (m_spill.empty())
+            {
+                static std::atomic<uint32_t> next{};
+                m_spill = m_spill_folder + "cppwin32_" + std::to_string(++next) + ".spill";
+                m_spill_file.open(m_spill, std::ios::out | std::ios::binary | std::ios::trunc);
+            }
+
+            m_first.for_each([&](std::string_view const& value)
+                {
+                    m_spill_file.write(value.data(), value.size());
+                });
+
+            m_spill_size += m_first.size();
+            m_spill_back = m_first.back();
+            m_first.clear();
+        }
+
+        // Keeps what write_scratch formats out of the output and out of spilling, and puts the writer back as
+        // it was even when formatting throws.
+        struct scratch_guard
+        {
+            writer_base* const owner;
+            size_t const size;
+#if defined(_DEBUG)
+            bool const debug_trace;
+#endif
+
+            explicit scratch_guard(writer_base* arg) :
+                owner(arg), size(arg->m_first.size())
+#if defined(_DEBUG)
+                , debug_trace(std::exchange(arg->debug_trace, false))
+#endif
+            {
+                ++owner->m_temp_depth;
+            }
+
+            ~scratch_guard()
+            {
+                owner->m_first.truncate(size);
+                --owner->m_temp_depth;
+#if defined(_DEBUG)
+                owner->debug_trace = debug_trace;
+#endif
+            }
+
+            scratch_guard(scratch_guard const&) = delete;
+            scratch_guard& operator=(scratch_guard const&) = delete;
+        };
+
+        text_buffer m_second;
+        text_buffer m_first;
+        std::string m_scratch;
+        bool m_swapped{};
+        uint32_t m_temp_depth{};
+        size_t m_spill_limit{ SIZE_MAX };
+        std::string m_spill_folder;
+        std::string m_spill;
+        std::ofstream m_spill_file;
+        uint64_t m_spill_size{};
+        char m_spill_back{};
     };
 
 
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <winmd_reader.h>
+#include "helpers.h"
+#include "manifest.h"
+#include "task_group.h"
+
+namespace cppwin32
+{
+    using namespace winmd::reader;
+
+    // The subset of the metadata reachable from a list of root types, functions and constants. Only these are
+    // projected when a root list is given.
+    struct projection_roots
+    {
+        std::set<TypeDef, row_less> types;
+        std::set<MethodDef, row_less> methods;
+        std::set<Field, row_less> fields;
+        std::map<std::string_view, cache::namespace_members> namespaces;
+        uint64_t fingerprint{};
+
+        bool contains(TypeDef const& type) const
+        {
+            return types.count(type) != 0;
+        }
+
+        bool contains(MethodDef const& method) const
+        {
+            return methods.count(method) != 0;
+        }
+
+        bool contains(Field const& field) const
+        {
+            return fields.count(field) != 0;
+        }
+    };
+
+    inline bool is_projected(MethodDef const& method)
+    {
+        return !settings.roots || settings.roots->contains(method);
+    }
+
+    inline bool is_projected(Field const& field)
+    {
+        return !settings.roots || settings.roots->contains(field);
+    }
+
+    inline void add_closure_edge(TypeSig const& signature, std::vector<TypeDef>& edges)
+    {
+        if (auto const index = std::get_if<coded_index<TypeDefOrRef>>(&signature.Type()))
+        {
+            if (auto const type = find(*index))
+            {
+                edges.push_back(type);
+            }
+        }
+    }
+
+    inline void add_closure_edges(MethodDef const& method, std::vector<TypeDef>& edges)
+    {
+        method_signature signature{ method };
+
+        if (signature.return_signature())
+        {
+            add_closure_edge(signature.return_signature().Type(), edges);
+        }
+
+        for (auto&& [param, param_signature] : signature.params())
+        {
+            add_closure_edge(param_signature->Type(), edges);
+        }
+    }
+
+    // The types needed to declare a type: field types, base interfaces, method and delegate signatures, plus
+    // the nested and enclosing types that are written out together with it.
+    inline void add_closure_edges(TypeDef const& type, std::vector<TypeDef>& edges)
+    {
+        if (auto const enclosing = type.EnclosingType())
+        {
+            edges.push_back(enclosing);
+        }
+
+        for (auto&& nested_type : type.get_cache().nested_types(type))
+        {
+            edges.push_back(nested_type);
+        }
+
+        switch (get_category(type))
+        {
+        case category::struct_type:
+            for (auto&& field : type.FieldList())
+            {
+                add_closure_edge(field.Signature().Type(), edges);
+            }
+            break;
+
+        case category::interface_type:
+            if (auto const base = get_base_interface(type))
+            {
+                if (auto const base_type = find(base))
+                {
+                    edges.push_back(base_type);
+                }
+            }
+            for (auto&& method : type.MethodList())
+            {
+                add_closure_edges(method, edges);
+            }
+            break;
+
+        case category::delegate_type:
+            add_closure_edges(get_delegate_method(type), edges);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    inline void resolve_root(cache const& c, std::string_view const& name, projection_roots& roots, std::vector<TypeDef>& found)
+    {
+        auto const dot = name.rfind('.');
+
+        if (dot == std::string_view::npos)
+        {
+            throw_invalid("Root '", std::string{ name }, "' is not a fully qualified name");
+        }
+
+        auto const ns = name.substr(0, dot);
+        auto const member = name.substr(dot + 1);
+
+        if (auto const type = c.find(ns, member))
+        {
+            found.push_back(type);
+            return;
+        }
+
+        auto const members = c.namespaces().find(ns);
+
+        if (members != c.namespaces().end())
+        {
+            for (auto&& type : members->second.classes)
+            {
+                for (auto&& method : type.MethodList())
+                {
+                    if (method.Name() == member)
+                    {
+                        roots.methods.insert(method);
+                        add_closure_edges(method, found);
+                        return;
+                    }
+                }
+
+                for (auto&& field : type.FieldList())
+                {
+                    if (field.Name() == member)
+                    {
+                        roots.fields.insert(field);
+                        return;
+                    }
+                }
+            }
+        }
+
+        throw_invalid("Root '", std::string{ name }, "' does not name a type, function or constant");
+    }
+
+    template <typename List>
+    void filter_members(List const& source, List& target, projection_roots const& roots)
+    {
+        for (auto&& type : source)
+        {
+            if (roots.contains(type))
+            {
+                target.push_back(type);
+            }
+        }
+    }
+
+    // Computes the transitive closure of the roots one level at a time. Each type is expanded exactly once and
+    // the signature decoding for a level is spread across the task group.
+    inline void compute_closure(cache const& c, projection_roots& roots, std::vector<TypeDef> frontier)
+    {
+        while (!frontier.empty())
+        {
+            std::vector<TypeDef> level;
+
+            for (auto&& type : frontier)
+            {
+                if (roots.types.insert(type).second)
+                {
+                    level.push_back(type);
+                }
+            }
+
+            size_t const chunk_size = 256;
+            std::vector<std::vector<TypeDef>> edges((level.size() + chunk_size - 1) / chunk_size);
+
+            {
+                task_group group{ settings.jobs };
+
+                for (size_t chunk = 0; chunk != edges.size(); ++chunk)
+                {
+                    group.add([&, chunk]
+                        {
+                            auto const last = (std::min)(level.size(), (chunk + 1) * chunk_size);
+
+                            for (auto i = chunk * chunk_size; i != last; ++i)
+                            {
+                                add_closure_edges(level[i], edges[chunk]);
+                            }
+                        }, chunk_size);
+                }
+
+                group.get();
+            }
+
+            frontier.clear();
+
+            for (auto&& list : edges)
+            {
+                for (auto&& type : list)
+                {
+                    if (!roots.contains(type))
+                    {
+                        frontier.push_back(type);
+                    }
+                }
+            }
+        }
+
+        for (auto&& [ns, members] : c.namespaces())
+        {
+            cache::namespace_members projected;
+
+            for (auto&& [name, type] : members.types)
+            {
+                if (roots.contains(type))
+                {
+                    projected.types.emplace(name, type);
+                }
+            }
+
+            filter_members(members.interfaces, projected.interfaces, roots);
+            filter_members(members.enums, projected.enums, roots);
+            filter_members(members.structs, projected.structs, roots);
+            filter_members(members.delegates, projected.delegates, roots);
+
+            for (auto&& type : members.classes)
+            {
+                auto const methods = type.MethodList();
+                auto const fields = type.FieldList();
+
+                if (std::any_of(methods.first, methods.second, [&](MethodDef const& method) { return roots.contains(method); })
+                    || std::any_of(fields.first, fields.second, [&](Field const& field) { return roots.contains(field); }))
+                {
+                    projected.types.emplace(type.TypeName(), type);
+                    projected.classes.push_back(type);
+                }
+            }
+
+            if (!projected.types.empty())
+            {
+                roots.namespaces.emplace(ns, std::move(projected));
+            }
+        }
+
+        fingerprint f;
+
+        for (auto&& type : roots.types)
+        {
+            f.add(type.TypeNamespace());
+            f.add(type.TypeName());
+        }
+
+        // Functions and constants are named with the class that holds them, since swapping two of them between
+        // classes changes what both namespaces project. The counts keep a name from moving between the lists.
+        f.add(static_cast<uint64_t>(roots.types.size()));
+        f.add(static_cast<uint64_t>(roots.methods.size()));
+
+        for (auto&& method : roots.methods)
+        {
+            auto const parent = method.Parent();
+            f.add(parent.TypeNamespace());
+            f.add(parent.TypeName());
+            f.add(method.Name());
+        }
+
+        for (auto&& field : roots.fields)
+        {
+            auto const parent = field.Parent();
+            f.add(parent.TypeNamespace());
+            f.add(parent.TypeName());
+            f.add(field.Name());
+        }
+
+        roots.fingerprint = f.value;
+    }
+
+    // Reads a list of fully qualified type, function and constant names, one per line. Functions and constants
+    // are named by the namespace of the class that holds them, e.g. Windows.Win32.Direct3D12.D3D12CreateDevice.
+    inline void read_roots(cache const& c, std::string const& filename, projection_roots& roots, std::vector<TypeDef>& found)
+    {
+        std::ifstream file{ filename };
+
+        if (!file)
+        {
+            throw_invalid("Could not read roots file '", filename, "'");
+        }
+
+        std::string line;
+
+        while (std::getline(file, line))
+        {
+            auto const first = line.find_first_not_of(" \t\r");
+
+            if (first == std::string::npos || line[first] == '#')
+            {
+                continue;
+            }
+
+            auto const last = line.find_last_not_of(" \t\r");
+            resolve_root(c, std::string_view{ line }.substr(first, last - first + 1), roots, found);
+        }
+    }
+}
@@ -1,156 +1,700 @@
 #pragma once
 
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <string>
 #include <vector>
 #include <winmd_reader.h>
 #include "helpers.h"
+#include "task_group.h"
 // For tracking "hard" dependencies between types that require a definition, not a forward declaration
 
 namespace cppwin32
 {
     using namespace winmd::reader;
+    // The graph is stored densely. Nodes are numbered in the order they are added and found through a table
+    // indexed by TypeDef row for each database. Edges are kept in one compressed (CSR) array, so the edges
+    // of node i are edges[offsets[i]] up to edges[offsets[i + 1]].
     struct type_dependency_graph
     {
-        type_dependency_graph() = default;
-        explicit type_dependency_graph(std::string_view type_namespace)
-            : type_namespace(type_namespace)
-        {}
-
-        enum class walk_state
+        enum class walk_state : uint8_t
         {
             not_started,
             walking,
             complete
         };
 
-        struct node
+        // Why a type depends on another. Only a value edge needs the other type defined first; a type named
+        // through a pointer, or a base interface named by a method parameter, only needs to be declared.
+        enum class edge_kind : uint8_t
+        {
+            value,
+            pointer,
+            base
+        };
+
+        // A cycle is only possible to write when forward declarations break it: every edge in it must be a
+        // pointer edge, and all of its types must be nested in the same type. A base interface cycle would be
+        // an interface deriving from itself.
+        enum class component_kind : uint8_t
+        {
+            acyclic,
+            declared_cycle,
+            defined_cycle
+        };
+
+        uint32_t size() const noexcept
+        {
+            return static_cast<uint32_t>(m_types.size());
+        }
+
+        // Calls back with every type after the types it depends on. Types not reached from an earlier root are
+        // taken as roots in row order, which keeps the output order stable. Types that depend on each other
+        // (a strongly connected component) are called back one after the other in row order when their cycle
+        // runs only through pointers between types nested in the same type. write_struct declares those at
+        // the top of the type that encloses them, before it defines any of its nested types. Any other cycle
+        // cannot be written, so it throws with its path. Each node and edge is visited once.
+        template <typename Callback>
+        void walk_graph(Callback c)
         {
-            std::vector<TypeDef> edges;
-            walk_state state = walk_state::not_started;
+            walk_components([&](uint32_t const* first, uint32_t const* last, component_kind const kind)
+                {
+                    if (kind == component_kind::defined_cycle)
+                    {
+                        throw_cycle(first, last);
+                    }
 
-            void add_edge(TypeDef const& edge)
+                    for (; first != last; ++first)
+                    {
+                        c(m_types[*first]);
+                    }
+                });
+        }
+
+        // A run of types in a component that depend on each other, so they must all be declared before any
+        // of them is defined.
+        struct cycle
+        {
+            uint32_t component;
+            uint32_t position;
+            uint32_t size;
+        };
+
+        struct partition
+        {
+            std::vector<std::vector<TypeDef>> components;
+            std::vector<std::pair<uint32_t, uint32_t>> order;
+            std::vector<cycle> cycles;
+        };
+
+        // Splits the graph into its independent (weakly connected) components. Each component lists its types
+        // in walk order, and order records the sequence walk_graph visits them in as (component, position) pairs
+        // so that output produced separately for each component can be stitched back together unchanged.
+        // Unlike walk_graph, no cycle is an error here: every cycle is recorded and left for the caller to
+        // resolve, as dependency_index does by giving namespaces that depend on each other one header.
+        partition partition_graph()
+        {
+            std::vector<uint32_t> parent(size());
+            std::iota(parent.begin(), parent.end(), 0);
+
+            auto find_root = [&parent](uint32_t id)
             {
-                if (std::find(edges.begin(), edges.end(), edge) == edges.end())
+                while (parent[id] != id)
                 {
-                    edges.push_back(edge);
+                    parent[id] = parent[parent[id]];
+                    id = parent[id];
+                }
+                return id;
+            };
+
+            for (uint32_t id = 0; id != size(); ++id)
+            {
+                for (auto edge = m_offsets[id]; edge != m_offsets[id + 1]; ++edge)
+                {
+                    auto const left = find_root(id);
+                    auto const right = find_root(m_edges[edge]);
+                    parent[(std::max)(left, right)] = (std::min)(left, right);
                 }
             }
-        };
 
-        std::map<TypeDef, node> graph;
-        using value_type = std::map<TypeDef, node>::value_type;
-        std::string_view type_namespace;
+            partition result;
+            std::vector<uint32_t> components(size(), UINT32_MAX);
+
+            walk_components([&](uint32_t const* first, uint32_t const* last, component_kind const kind)
+                {
+                    // The types of a strongly connected component are always in the same weakly connected one.
+                    auto& component = components[find_root(*first)];
+                    if (component == UINT32_MAX)
+                    {
+                        component = static_cast<uint32_t>(result.components.size());
+                        result.components.emplace_back();
+                    }
+
+                    auto& types = result.components[component];
+
+                    if (kind != component_kind::acyclic)
+                    {
+                        result.cycles.push_back({ component, static_cast<uint32_t>(types.size()), static_cast<uint32_t>(last - first) });
+                    }
+
+                    for (; first != last; ++first)
+                    {
+                        result.order.emplace_back(component, static_cast<uint32_t>(types.size()));
+                        types.push_back(m_types[*first]);
+                    }
+                });
+
+            return result;
+        }
 
+        // Calls back with (type, dependency) for every edge.
         template <typename Callback>
-        void walk_graph(Callback c)
+        void for_each_edge(Callback c) const
         {
-            auto eligible = [](value_type const& v) { return v.second.state == walk_state::not_started; };
-            for (auto it = std::find_if(graph.begin(), graph.end(), eligible)
-                ; it != graph.end()
-                ; it = std::find_if(graph.begin(), graph.end(), eligible))
+            for (uint32_t id = 0; id + 1 < m_offsets.size(); ++id)
             {
-                visit(*it, c);
+                for (auto edge = m_offsets[id]; edge != m_offsets[id + 1]; ++edge)
+                {
+                    c(m_types[id], m_types[m_edges[edge]]);
+                }
             }
         }
 
         void reset_walk_state()
         {
-            for (auto& value : graph)
-            {
-                value.second.state = walk_state::not_started;
-            }
+            std::fill(m_states.begin(), m_states.end(), walk_state::not_started);
         }
 
-        void add_struct(TypeDef const& type)
+        // A struct depends on the structs it holds by value.
+        struct struct_edges
         {
-            auto [it, inserted] = graph.insert({ type, {} });
-            if (!inserted) return;
+            template <typename F>
+            void operator()(TypeDef const& type, F&& add_edge) const
+            {
+                for (auto&& field : type.FieldList())
+                {
+                    auto const& signature = field.Signature();
+                    if (auto const field_type = std::get_if<coded_index<TypeDefOrRef>>(&signature.Type().Type()))
+                    {
+                        if (signature.Type().ptr_count() == 0 || is_nested(*field_type))
+                        {
+                            auto field_type_def = find(*field_type);
+                            if (field_type_def && get_category(field_type_def) == category::struct_type)
+                            {
+                                add_edge(field_type_def, signature.Type().ptr_count() == 0 ? edge_kind::value : edge_kind::pointer);
+                            }
+                        }
+                    }
+                }
+            }
+        };
 
-            for (auto&& field : type.FieldList())
+        // A delegate depends on the delegates in its signature. Delegates in other namespaces are declared by
+        // the headers that are included first.
+        struct delegate_edges
+        {
+            template <typename F>
+            void operator()(TypeDef const& type, F&& add_edge) const
             {
-                auto const& signature = field.Signature();
-                if (auto const field_type = std::get_if<coded_index<TypeDefOrRef>>(&signature.Type().Type()))
+                method_signature method_signature{ get_delegate_method(type) };
+                auto add_param = [&](TypeSig const& signature)
                 {
-                    if (signature.Type().ptr_count() == 0 || is_nested(*field_type))
+                    auto index = std::get_if<coded_index<TypeDefOrRef>>(&signature.Type());
+                    if (index)
                     {
-                        auto field_type_def = find(*field_type);
-                        if (field_type_def && get_category(field_type_def) == category::struct_type)
+                        auto param_type_def = find(*index);
+                        if (param_type_def && get_category(param_type_def) == category::delegate_type
+                            && param_type_def.TypeNamespace() == type.TypeNamespace())
                         {
-                            it->second.add_edge(field_type_def);
-                            add_struct(field_type_def);
+                            // A delegate is an alias of a function type, which cannot be forward declared.
+                            add_edge(param_type_def, edge_kind::value);
                         }
                     }
+                };
+                add_param(method_signature.return_signature().Type());
+                for (auto const& [param, param_sig] : method_signature.params())
+                {
+                    add_param(param_sig->Type());
                 }
             }
+        };
+
+        // An interface depends on its base interface.
+        struct interface_edges
+        {
+            template <typename F>
+            void operator()(TypeDef const& type, F&& add_edge) const
+            {
+                auto const base_index = get_base_interface(type);
+                if (base_index)
+                {
+                    if (auto const base_type = find(base_index))
+                    {
+                        add_edge(base_type, edge_kind::base);
+                    }
+                }
+            }
+        };
+
+        void add_struct(TypeDef const& type)
+        {
+            add(type, struct_edges{});
         }
 
         void add_delegate(TypeDef const& type)
         {
-            auto [it, inserted] = graph.insert({ type, {} });
-            if (!inserted) return;
+            add(type, delegate_edges{});
+        }
+
+        void add_interface(TypeDef const& type)
+        {
+            add(type, interface_edges{});
+        }
+
+        // Adds the type and everything reachable from it. get_edges(type, add_edge) reports the types a type
+        // depends on, each with an optional edge_kind that defaults to value. New nodes are expanded in the order
+        // they were numbered, which is what lets each node's edges be appended to the end of the edge array.
+        template <typename F>
+        void add(TypeDef const& type, F&& get_edges)
+        {
+            insert(type);
+            expand({}, get_edges);
+        }
 
-            method_signature method_signature{ get_delegate_method(type) };
-            auto add_param = [this, current = it](TypeSig const& type)
+        // Adds every type in the batches and everything reachable from them. Decoding signatures and resolving
+        // the types they name is most of the cost, so each batch is resolved on its own task into a list that
+        // only that task writes. The lists are then merged on this thread in batch order, which gives the same
+        // graph whatever order the tasks finish in.
+        template <typename F>
+        void add(std::vector<std::vector<TypeDef> const*> const& batches, F const& get_edges)
+        {
+            auto const first = static_cast<uint32_t>(m_offsets.size()) - 1;
+
+            for (auto&& batch : batches)
             {
-                auto index = std::get_if<coded_index<TypeDefOrRef>>(&type.Type());
-                if (index)
+                for (auto&& type : *batch)
                 {
-                    auto param_type_def = find(*index);
-                    if (param_type_def && get_category(param_type_def) == category::delegate_type)
+                    insert(type);
+                }
+            }
+
+            std::vector<std::vector<resolved_type>> resolved(batches.size());
+
+            {
+                task_group group{ settings.jobs };
+
+                for (size_t i = 0; i != batches.size(); ++i)
+                {
+                    group.add([&, i]
+                        {
+                            resolve(*batches[i], first, get_edges, resolved[i]);
+                        }, batches[i]->size());
+                }
+
+                group.get();
+            }
+
+            std::vector<std::vector<resolved_edge> const*> lists;
+
+            for (auto&& batch : resolved)
+            {
+                for (auto&& [type, edges] : batch)
+                {
+                    auto const id = insert(type) - first;
+
+                    if (id >= lists.size())
+                    {
+                        lists.resize(id + 1);
+                    }
+
+                    if (!lists[id])
                     {
-                        if (type_namespace.empty() || type_namespace == param_type_def.TypeName())
+                        lists[id] = &edges;
+                    }
+                }
+            }
+
+            expand(lists, get_edges);
+        }
+
+    private:
+
+        struct database_nodes
+        {
+            database const* db;
+            std::vector<uint32_t> nodes;
+        };
+
+        struct frame
+        {
+            uint32_t id;
+            uint32_t edge;
+        };
+
+        struct resolved_edge
+        {
+            TypeDef type;
+            edge_kind kind;
+        };
+
+        struct resolved_type
+        {
+            TypeDef type;
+            std::vector<resolved_edge> edges;
+        };
+
+        // Finds the edges of the types in the batch that are not yet expanded, along with those of any types
+        // reachable from them that are not in the graph at all, such as nested structs. The graph is only read.
+        template <typename F>
+        void resolve(std::vector<TypeDef> const& batch, uint32_t const first, F const& get_edges, std::vector<resolved_type>& result) const
+        {
+            std::vector<TypeDef> pending;
+            pending.reserve(batch.size());
+
+            for (auto&& type : batch)
+            {
+                if (find_node(type) >= first)
+                {
+                    pending.push_back(type);
+                }
+            }
+
+            auto const roots = pending.size();
+
+            for (size_t i = 0; i != pending.size(); ++i)
+            {
+                resolved_type current{ pending[i], {} };
+
+                get_edges(current.type, [&](TypeDef const& edge, edge_kind const kind = edge_kind::value)
+                    {
+                        current.edges.push_back({ edge, kind });
+
+                        if (find_node(edge) == UINT32_MAX && std::find(pending.begin() + roots, pending.end(), edge) == pending.end())
                         {
-                            current->second.add_edge(param_type_def);
-                            add_delegate(param_type_def);
+                            pending.push_back(edge);
                         }
+                    });
+
+                result.push_back(std::move(current));
+            }
+        }
+
+        // Expands the nodes that have no edges yet, in the order they were numbered. Edge lists resolved ahead of
+        // time are indexed from the first such node. Any node without one is resolved here.
+        template <typename F>
+        void expand(std::vector<std::vector<resolved_edge> const*> const& lists, F&& get_edges)
+        {
+            auto const first = static_cast<uint32_t>(m_offsets.size()) - 1;
+
+            for (uint32_t id = first; id != size(); ++id)
+            {
+                // A type named more than once keeps its strongest edge: a value edge over any other.
+                auto add_edge = [&](TypeDef const& edge, edge_kind const kind = edge_kind::value)
+                {
+                    auto const target = insert(edge);
+
+                    // Number of edges on an individual node should be small, so a linear search is fine.
+                    auto const existing = std::find(m_edges.begin() + m_offsets[id], m_edges.end(), target);
+
+                    if (existing == m_edges.end())
+                    {
+                        m_edges.push_back(target);
+                        m_kinds.push_back(kind);
+                    }
+                    else if (kind == edge_kind::value)
+                    {
+                        m_kinds[existing - m_edges.begin()] = kind;
+                    }
+                };
+
+                if (id - first < lists.size() && lists[id - first])
+                {
+                    for (auto&& edge : *lists[id - first])
+                    {
+                        add_edge(edge.type, edge.kind);
                     }
                 }
-            };
-            add_param(method_signature.return_signature().Type());
-            for (auto const& [param, param_sig] : method_signature.params())
+                else
+                {
+                    get_edges(m_types[id], add_edge);
+                }
+
+                m_offsets.push_back(static_cast<uint32_t>(m_edges.size()));
+            }
+        }
+
+        uint32_t find_node(TypeDef const& type) const
+        {
+            auto& db = type.get_database();
+            auto rows = std::find_if(m_databases.begin(), m_databases.end(), [&](database_nodes const& value) { return value.db == &db; });
+            return rows == m_databases.end() ? UINT32_MAX : rows->nodes[type.index()];
+        }
+
+        uint32_t insert(TypeDef const& type)
+        {
+            auto& db = type.get_database();
+            auto rows = std::find_if(m_databases.begin(), m_databases.end(), [&](database_nodes const& value) { return value.db == &db; });
+
+            if (rows == m_databases.end())
             {
-                add_param(param_sig->Type());
+                rows = m_databases.insert(m_databases.end(), { &db, std::vector<uint32_t>(db.TypeDef.size(), UINT32_MAX) });
             }
+
+            auto& node = rows->nodes[type.index()];
+
+            if (node == UINT32_MAX)
+            {
+                node = size();
+                m_types.push_back(type);
+                m_states.push_back(walk_state::not_started);
+            }
+
+            return node;
         }
 
-        void add_interface(TypeDef const& type)
+        std::vector<uint32_t> get_row_order() const
         {
-            auto [it, inserted] = graph.insert({ type, {} });
-            if (!inserted) return;
+            std::vector<uint32_t> order(size());
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(), [this](uint32_t left, uint32_t right) { return row_less{}(m_types[left], m_types[right]); });
+            return order;
+        }
 
-            auto const base_index = get_base_interface(type);
-            if (base_index)
+        component_kind get_component_kind(uint32_t const* first, uint32_t const* last, std::vector<uint32_t> const& component_of) const
+        {
+            auto const component = component_of[*first];
+            bool cyclic{};
+            bool pointer{};
+
+            for (auto member = first; member != last; ++member)
+            {
+                for (auto edge = m_offsets[*member]; edge != m_offsets[*member + 1]; ++edge)
+                {
+                    if (component_of[m_edges[edge]] != component)
+                    {
+                        continue;
+                    }
+
+                    if (m_kinds[edge] == edge_kind::value)
+                    {
+                        return component_kind::defined_cycle;
+                    }
+
+                    cyclic = true;
+                    pointer = pointer || m_kinds[edge] == edge_kind::pointer;
+                }
+            }
+
+            if (!cyclic)
+            {
+                return component_kind::acyclic;
+            }
+
+            if (!pointer)
+            {
+                return component_kind::defined_cycle;
+            }
+
+            // Nested types are spelled by name alone, so only those inside the same type can name each other.
+            auto const outermost = get_outermost_type(m_types[*first]);
+
+            for (auto member = first + 1; member != last; ++member)
             {
-                auto const base_type = find(base_index);
-                if (base_type
-                    && (type_namespace.empty() || type_namespace == base_type.TypeNamespace()))
+                if (get_outermost_type(m_types[*member]) != outermost)
                 {
-                    it->second.add_edge(base_type);
-                    add_interface(base_type);
+                    return component_kind::defined_cycle;
                 }
             }
+
+            return component_kind::declared_cycle;
         }
 
-    private:
+        static TypeDef get_outermost_type(TypeDef type)
+        {
+            while (is_nested(type))
+            {
+                type = type.EnclosingType();
+            }
+
+            return type;
+        }
+
+        static void append_name(std::string& message, TypeDef const& type)
+        {
+            if (is_nested(type))
+            {
+                append_name(message, type.EnclosingType());
+                message += '.';
+            }
+            else
+            {
+                message.append(type.TypeNamespace()).append(".");
+            }
+
+            message.append(type.TypeName());
+        }
 
+        // Reports a cycle through the first edge of the component that forward declarations cannot break, as
+        // in "A.B -> C.D -> A.B". The rest of the path is the shortest one back within the component.
+        [[noreturn]] void throw_cycle(uint32_t const* first, uint32_t const* last) const
+        {
+            std::vector<uint32_t> members(first, last);
+            std::sort(members.begin(), members.end());
+            auto member = [&](uint32_t const id) { return std::binary_search(members.begin(), members.end(), id); };
+
+            auto find_edge = [&](bool const value_only)
+            {
+                for (auto id = first; id != last; ++id)
+                {
+                    for (auto edge = m_offsets[*id]; edge != m_offsets[*id + 1]; ++edge)
+                    {
+                        if (member(m_edges[edge]) && (!value_only || m_kinds[edge] == edge_kind::value))
+                        {
+                            return std::pair{ *id, m_edges[edge] };
+                        }
+                    }
+                }
+
+                return std::pair{ UINT32_MAX, UINT32_MAX };
+            };
+
+            auto [source, target] = find_edge(true);
+
+            if (source == UINT32_MAX)
+            {
+                std::tie(source, target) = find_edge(false);
+            }
+
+            std::vector<uint32_t> parent(size(), UINT32_MAX);
+            std::vector<uint32_t> queue{ target };
+            parent[target] = target;
+
+            for (size_t i = 0; i != queue.size() && parent[source] == UINT32_MAX; ++i)
+            {
+                for (auto edge = m_offsets[queue[i]]; edge != m_offsets[queue[i] + 1]; ++edge)
+                {
+                    auto const next = m_edges[edge];
+
+                    if (member(next) && parent[next] == UINT32_MAX)
+                    {
+                        parent[next] = queue[i];
+                        queue.push_back(next);
+                    }
+                }
+            }
+
+            std::vector<uint32_t> path{ source };
+
+            for (auto id = source; id != target; id = parent[id])
+            {
+                path.push_back(parent[id]);
+            }
+
+            std::string message{ "Cyclic dependency graph encountered: " };
+            append_name(message, m_types[source]);
+
+            for (auto id = path.rbegin(); id != path.rend(); ++id)
+            {
+                message.append(" -> ");
+                append_name(message, m_types[*id]);
+            }
+
+            throw std::invalid_argument(message);
+        }
+
+        // Tarjan's algorithm, with an explicit stack so deep dependency chains cannot overflow the call stack.
+        // A type is walking from when it is reached until its component is complete. Components are called
+        // back as (first, last, kind) after the components they depend on. Without cycles, that is the same
+        // post-order as a plain depth-first walk.
         template<typename Callback>
-        void visit(value_type& v, Callback c)
+        void walk_components(Callback c)
         {
-#ifdef _DEBUG
-            auto type_name = v.first.TypeName();
-#endif
-            if (v.second.state == walk_state::complete) return;
-            if (v.second.state == walk_state::walking) throw std::invalid_argument("Cyclic dependency graph encountered at type " + std::string(v.first.TypeNamespace()) + "." + std::string(v.first.TypeName()));
+            std::vector<uint32_t> index(size(), UINT32_MAX);
+            std::vector<uint32_t> low(size());
+            std::vector<uint32_t> walking;
+            std::vector<frame> stack;
+            std::vector<uint32_t> component_of(size(), UINT32_MAX);
+            uint32_t next{};
+            uint32_t components{};
 
-            v.second.state = walk_state::walking;
-            for (auto&& edge : v.second.edges)
+            auto start = [&](uint32_t const id)
             {
-                auto it = graph.find(edge);
-                XLANG_ASSERT(it != graph.end());
-                visit(*it, c);
+                index[id] = low[id] = next++;
+                m_states[id] = walk_state::walking;
+                walking.push_back(id);
+                stack.push_back({ id, m_offsets[id] });
+            };
+
+            for (auto&& root : get_row_order())
+            {
+                if (m_states[root] != walk_state::not_started)
+                {
+                    continue;
+                }
+
+                start(root);
+
+                while (!stack.empty())
+                {
+                    auto& top = stack.back();
+
+                    if (top.edge != m_offsets[top.id + 1])
+                    {
+                        auto const target = m_edges[top.edge++];
+
+                        if (m_states[target] == walk_state::not_started)
+                        {
+                            start(target);
+                        }
+                        else if (m_states[target] == walk_state::walking)
+                        {
+                            low[top.id] = (std::min)(low[top.id], index[target]);
+                        }
+
+                        continue;
+                    }
+
+                    auto const id = top.id;
+                    stack.pop_back();
+
+                    if (!stack.empty())
+                    {
+                        low[stack.back().id] = (std::min)(low[stack.back().id], low[id]);
+                    }
+
+                    if (low[id] != index[id])
+                    {
+                        continue;
+                    }
+
+                    auto const first = std::find(walking.rbegin(), walking.rend(), id).base() - 1;
+                    auto const count = walking.end() - first;
+
+                    if (count > 1)
+                    {
+                        std::sort(first, walking.end(), [this](uint32_t left, uint32_t right) { return row_less{}(m_types[left], m_types[right]); });
+                    }
+
+                    for (auto it = first; it != walking.end(); ++it)
+                    {
+                        m_states[*it] = walk_state::complete;
+                        component_of[*it] = components;
+                    }
+
+                    c(&*first, &*first + count, get_component_kind(&*first, &*first + count, component_of));
+                    ++components;
+                    walking.erase(first, walking.end());
+                }
             }
-            v.second.state = walk_state::complete;
-            c(v.first);
         }
+
+        std::vector<database_nodes> m_databases;
+        std::vector<TypeDef> m_types;
+        std::vector<walk_state> m_states;
+        std::vector<uint32_t> m_offsets{ 0 };
+        std::vector<uint32_t> m_edges;
+        std::vector<edge_kind> m_kinds;
     };
 }
 
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <winmd_reader.h>
+#include "helpers.h"
+
+namespace cppwin32
+{
+    using namespace winmd::reader;
+
+    // How a type is spelled in generated code. The full spelling carries the win32:: prefix and the short
+    // one starts past it. A TypeRef that resolves to a TypeDef remembers the definition, since that is what
+    // the writer registers as a dependency.
+    struct type_spelling
+    {
+        std::string text;
+        size_t offset{};
+        TypeDef definition;
+
+        std::string_view get(bool const full_namespace) const noexcept
+        {
+            return std::string_view{ text }.substr(full_namespace ? 0 : offset);
+        }
+    };
+
+    // Resolves and spells each type once for the whole run. Lookups vastly outnumber insertions, so entries
+    // are spread over shards that are each guarded by a reader-writer lock.
+    struct type_spelling_cache
+    {
+        type_spelling const& get(TypeDef const& type)
+        {
+            return get(key{ &type.get_database(), type.index(), false }, [&]
+                {
+                    type_spelling result;
+                    result.definition = type;
+
+                    if (is_nested(type))
+                    {
+                        result.text = type.TypeName();
+                    }
+                    else
+                    {
+                        spell(result, type.TypeNamespace(), type.TypeName());
+                    }
+
+                    return result;
+                });
+        }
+
+        // Only for references that are neither nested nor System.Guid, which the writer spells directly.
+        type_spelling const& get(TypeRef const& type)
+        {
+            return get(key{ &type.get_database(), type.index(), true }, [&]
+                {
+                    if (auto const definition = find(type))
+                    {
+                        return get(definition);
+                    }
+
+                    type_spelling result;
+                    spell(result, type.TypeNamespace(), type.TypeName());
+                    return result;
+                });
+        }
+
+    private:
+
+        struct key
+        {
+            void const* database;
+            uint32_t index;
+            bool reference;
+
+            bool operator==(key const& other) const noexcept
+            {
+                return database == other.database && index == other.index && reference == other.reference;
+            }
+        };
+
+        struct key_hash
+        {
+            size_t operator()(key const& value) const noexcept
+            {
+                return std::hash<void const*>{}(value.database) ^ (static_cast<size_t>(value.index) << 1 | value.reference);
+            }
+        };
+
+        struct shard
+        {
+            std::shared_mutex lock;
+            std::unordered_map<key, type_spelling, key_hash> spellings;
+        };
+
+        static void spell(type_spelling& result, std::string_view const& type_namespace, std::string_view const& type_name)
+        {
+            result.text.reserve(7 + type_namespace.size() * 2 + 2 + type_name.size());
+            result.text = "win32::";
+            result.offset = result.text.size();
+
+            for (auto&& c : type_namespace)
+            {
+                if (c == '.')
+                {
+                    result.text += "::";
+                }
+                else
+                {
+                    result.text += c;
+                }
+            }
+
+            result.text += "::";
+            result.text += type_name;
+        }
+
+        // Entries live in node-based maps, so references to them stay valid as other entries are added.
+        template <typename F>
+        type_spelling const& get(key const& value, F&& make)
+        {
+            auto& shard = m_shards[key_hash{}(value) % m_shards.size()];
+
+            {
+                std::shared_lock lock{ shard.lock };
+                auto it = shard.spellings.find(value);
+
+                if (it != shard.spellings.end())
+                {
+                    return it->second;
+                }
+            }
+
+            auto result = make();
+            std::unique_lock lock{ shard.lock };
+            return shard.spellings.try_emplace(value, std::move(result)).first->second;
+        }
+
+        std::array<shard, 64> m_shards;
+    };
+
+    inline type_spelling_cache& get_type_spellings()
+    {
+        static type_spelling_cache cache;
+        return cache;
+    }
+}
@@ -2,25 +2,16 @@
 
 #include <winmd_reader.h>
 #include "text_writer.h"
+#include "compile_report.h"
+#include "output_stage.h"
 #include "helpers.h"
+#include "type_spellings.h"
+#include "utf8.h"
 
 namespace cppwin32
 {
     using namespace winmd::reader;
 
-    template <typename First, typename... Rest>
-    auto get_impl_name(First const& first, Rest const&... rest)
-    {
-        std::string result;
-        result.reserve(std::string_view(first).size() + ((1 + std::string_view(rest).size()), ...));
-        ((result += first), (((result += '_') += rest), ...));
-        std::transform(result.begin(), result.end(), result.begin(), [](char c)
-            {
-                return c == '.' ? '_' : c;
-            });
-        return result;
-    }
-
     struct writer : writer_base<writer>
     {
         using writer_base<writer>::write;
@@ -43,6 +34,9 @@ namespace cppwin32
         bool consume_types{};
         std::map<std::string_view, std::set<TypeDef, depends_compare>> depends;
         std::map<std::string_view, std::set<TypeRef, depends_compare>> extern_depends;
+        std::vector<std::pair<std::string_view, char>> includes;
+        std::vector<std::string> fragments;
+        uint32_t declarations{};
 
         template<typename T>
         struct member_value_guard
@@ -64,6 +58,14 @@ namespace cppwin32
             member_value_guard& operator=(member_value_guard const&) = delete;
         };
 
+        writer()
+        {
+            if (settings.spill_limit)
+            {
+                spill_to(settings.output_folder + "win32/impl/", settings.spill_limit);
+            }
+        }
+
         [[nodiscard]] auto push_abi_types(bool value)
         {
             return member_value_guard(this, &writer::abi_types, value);
@@ -81,10 +83,10 @@ namespace cppwin32
 
         void write_root_include(std::string_view const& include)
         {
-            auto format = R"(#include %win32/%.h%
-)";
+            static constexpr format_string format{ R"(#include %win32/%.h%
+)" };
 
-            write(format,
+            write<format>(
                 settings.brackets ? '<' : '\"',
                 include,
                 settings.brackets ? '>' : '\"');
@@ -107,11 +109,27 @@ namespace cppwin32
             extern_depends[ns].insert(type);
         }
 
+        void merge_depends(writer const& other)
+        {
+            for (auto&& [ns, types] : other.depends)
+            {
+                depends[ns].insert(types.begin(), types.end());
+            }
+
+            for (auto&& [ns, types] : other.extern_depends)
+            {
+                extern_depends[ns].insert(types.begin(), types.end());
+            }
+        }
+
+        // The includes are remembered for the module partition of the header and for the compile-cost report.
         void write_depends(std::string_view const& ns, char impl = 0)
         {
+            includes.emplace_back(ns, impl);
+
             if (impl)
             {
-                write_root_include(write_temp("impl/%.%", ns, impl));
+                write_root_include(write_scratch("impl/%.%", ns, impl));
             }
             else
             {
@@ -119,6 +137,12 @@ namespace cppwin32
             }
         }
 
+        void write_fragment_include(std::string_view const& fragment)
+        {
+            fragments.emplace_back(fragment);
+            write_root_include(write_scratch("fragments/%.%", type_namespace, fragment));
+        }
+
         template <typename T>
         void write_value(T value)
         {
@@ -255,32 +279,16 @@ namespace cppwin32
 
         void write(std::u16string_view const& str)
         {
-            auto const data = reinterpret_cast<wchar_t const*>(str.data());
-            auto const size = ::WideCharToMultiByte(CP_UTF8, 0, data, static_cast<int32_t>(str.size()), nullptr, 0, nullptr, nullptr);
-            if (size == 0)
-            {
-                return;
-            }
-            std::string result(size, '?');
-            ::WideCharToMultiByte(CP_UTF8, 0, data, static_cast<int32_t>(str.size()), result.data(), size, nullptr, nullptr);
-            write(result);
+            utf16_to_utf8(str, [&](std::string_view const& value)
+                {
+                    write(value);
+                });
         }
 
         void write(TypeDef const& type)
         {
             add_depends(type);
-            if (is_nested(type))
-            {
-                write(type.TypeName());
-            }
-            else
-            {
-                if (full_namespace)
-                {
-                    write("win32::");
-                }
-                write("@::%", type.TypeNamespace(), type.TypeName());
-            }
+            write(get_type_spellings().get(type).get(full_namespace));
         }
 
         void write(TypeRef const& type)
@@ -295,18 +303,18 @@ namespace cppwin32
             }
             else
             {
-                auto type_def = find(type);
-                if (type_def)
+                auto const& spelling = get_type_spellings().get(type);
+
+                if (spelling.definition)
                 {
-                    write(type_def);
-                    return;
+                    add_depends(spelling.definition);
                 }
-                add_extern_depends(type);
-                if (full_namespace)
+                else
                 {
-                    write("win32::");
+                    add_extern_depends(type);
                 }
-                write("@::%", type.TypeNamespace(), type.TypeName());
+
+                write(spelling.get(full_namespace));
             }
         }
 
@@ -412,24 +420,85 @@ namespace cppwin32
             }
         }
 
-        void save_header(char impl = 0)
+        void flush_to_file(std::string const& filename)
+        {
+            if (settings.output)
+            {
+                settings.output->push(filename, release());
+            }
+            else
+            {
+                writer_base<writer>::flush_to_file(filename);
+            }
+        }
+
+        // The path of a header relative to the output folder.
+        static std::string get_header_path(std::string_view const& ns, char impl = 0)
         {
-            auto filename{ settings.output_folder + "win32/" };
+            std::string path{ "win32/" };
             if (impl)
             {
-                filename += "impl/";
+                path += "impl/";
             }
 
-            filename += type_namespace;
+            path += ns;
 
             if (impl)
             {
-                filename += '.';
-                filename += impl;
+                path += '.';
+                path += impl;
+            }
+
+            path += ".h";
+            return path;
+        }
+
+        static std::string get_fragment_path(std::string_view const& ns, std::string_view const& fragment)
+        {
+            std::string path{ "win32/fragments/" };
+            path += ns;
+            path += '.';
+            path += fragment;
+            path += ".h";
+            return path;
+        }
+
+        // The namespace header and its fragments include base.h through their version check.
+        void save_header(char impl = 0)
+        {
+            save(get_header_path(type_namespace, impl), !impl);
+        }
+
+        void save_fragment(std::string_view const& fragment)
+        {
+            save(get_fragment_path(type_namespace, fragment), true);
+        }
+
+        void save(std::string const& path, bool const includes_base)
+        {
+            if (settings.report)
+            {
+                std::vector<std::string> paths;
+
+                if (includes_base)
+                {
+                    paths.push_back(get_header_path("base"));
+                }
+
+                for (auto&& [ns, include_impl] : includes)
+                {
+                    paths.push_back(get_header_path(ns, include_impl));
+                }
+
+                for (auto&& fragment : fragments)
+                {
+                    paths.push_back(get_fragment_path(type_namespace, fragment));
+                }
+
+                settings.report->add(path, size(), declarations, std::move(paths));
             }
 
-            filename += ".h";
-            flush_to_file(filename);
+            flush_to_file(settings.output_folder + path);
         }
     };
 }
\ No newline at end of file
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CPPWIN32_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace cppwin32
+{
+    // Converts UTF-16 to UTF-8 and hands the result to the callback a block at a time, without allocating.
+    // Unpaired surrogates become U+FFFD, as they do with WideCharToMultiByte. String constants in the
+    // metadata are nearly all ASCII, so where SSE2 is available runs of ASCII are narrowed eight code units
+    // at a time.
+    template <typename F>
+    void utf16_to_utf8(std::u16string_view const& text, F&& callback)
+    {
+        char buffer[256];
+        size_t size{};
+        auto first = text.data();
+        auto const last = first + text.size();
+
+        auto flush = [&]
+        {
+            callback(std::string_view{ buffer, size });
+            size = 0;
+        };
+
+        while (first != last)
+        {
+            // The largest single step below is eight bytes.
+            if (size + 8 > sizeof(buffer))
+            {
+                flush();
+            }
+
+#if defined(CPPWIN32_SSE2)
+            if (last - first >= 8)
+            {
+                auto const units = _mm_loadu_si128(reinterpret_cast<__m128i const*>(first));
+                auto const high = _mm_and_si128(units, _mm_set1_epi16(static_cast<short>(0xff80)));
+
+                if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xffff)
+                {
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(buffer + size), _mm_packus_epi16(units, units));
+                    size += 8;
+                    first += 8;
+                    continue;
+                }
+            }
+#endif
+
+            uint32_t code = *first++;
+
+            if (code >= 0xd800 && code <= 0xdfff)
+            {
+                if (code <= 0xdbff && first != last && *first >= 0xdc00 && *first <= 0xdfff)
+                {
+                    code = 0x10000 + ((code - 0xd800) << 10) + (*first++ - 0xdc00);
+                }
+                else
+                {
+                    code = 0xfffd;
+                }
+            }
+
+            if (code < 0x80)
+            {
+                buffer[size++] = static_cast<char>(code);
+            }
+            else if (code < 0x800)
+            {
+                buffer[size++] = static_cast<char>(0xc0 | (code >> 6));
+                buffer[size++] = static_cast<char>(0x80 | (code & 0x3f));
+            }
+            else if (code < 0x10000)
+            {
+                buffer[size++] = static_cast<char>(0xe0 | (code >> 12));
+                buffer[size++] = static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+                buffer[size++] = static_cast<char>(0x80 | (code & 0x3f));
+            }
+            else
+            {
+                buffer[size++] = static_cast<char>(0xf0 | (code >> 18));
+                buffer[size++] = static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+                buffer[size++] = static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+                buffer[size++] = static_cast<char>(0x80 | (code & 0x3f));
+            }
+        }
+
+        if (size)
+        {
+            flush();
+        }
+    }
+}
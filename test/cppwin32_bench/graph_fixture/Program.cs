@@ -0,0 +1,83 @@
+// Writes a metadata file with the given number of structs in the Graph namespace for the graph benchmark.
+// Struct N holds struct N - 1 by value, so the dependency chain is as deep as the file is large, and up to
+// two earlier structs picked at random. It also points at a later struct, which is decoded but is not an edge.
+// Only the first structs can be added to a graph to measure a smaller one, since edges only lead back.
+//
+// dotnet run -c Release -- <count> <Graph.winmd>
+
+using System;
+using System.IO;
+using System.Reflection;
+using System.Reflection.Metadata;
+using System.Reflection.Metadata.Ecma335;
+using System.Reflection.PortableExecutable;
+
+if (args.Length != 2 || !int.TryParse(args[0], out var count) || count <= 0)
+{
+    Console.Error.WriteLine("GraphFixture <count> <Graph.winmd>");
+    return 1;
+}
+
+var metadata = new MetadataBuilder();
+metadata.AddModule(0, metadata.GetOrAddString(Path.GetFileName(args[1])), metadata.GetOrAddGuid(new Guid("0c3c4f4e-6b1d-4e8a-a7f2-5d9e1b2c3a40")), default, default);
+metadata.AddAssembly(metadata.GetOrAddString("Graph"), new Version(1, 0, 0, 0), default, default, 0, AssemblyHashAlgorithm.None);
+
+var netstandard = metadata.AddAssemblyReference(metadata.GetOrAddString("netstandard"), new Version(2, 1, 0, 0), default,
+    metadata.GetOrAddBlob(new byte[] { 0xcc, 0x7b, 0x13, 0xff, 0xcd, 0x2d, 0xdd, 0x51 }), 0, default);
+var valueType = metadata.AddTypeReference(netstandard, metadata.GetOrAddString("System"), metadata.GetOrAddString("ValueType"));
+
+var firstMethod = MetadataTokens.MethodDefinitionHandle(1);
+metadata.AddTypeDefinition(default, default, metadata.GetOrAddString("<Module>"), default, MetadataTokens.FieldDefinitionHandle(1), firstMethod);
+
+var ns = metadata.GetOrAddString("Graph");
+var random = new Random(1);
+var fields = 0;
+
+// Row 1 is <Module>, so struct N is row N + 2.
+TypeDefinitionHandle row(int index) => MetadataTokens.TypeDefinitionHandle(index + 2);
+
+BlobHandle field(Action<SignatureTypeEncoder> type)
+{
+    var blob = new BlobBuilder();
+    type(new BlobEncoder(blob).FieldSignature());
+    return metadata.GetOrAddBlob(blob);
+}
+
+void add_field(string name, BlobHandle signature)
+{
+    metadata.AddFieldDefinition(FieldAttributes.Public, metadata.GetOrAddString(name), signature);
+    ++fields;
+}
+
+for (var index = 0; index != count; ++index)
+{
+    var first = MetadataTokens.FieldDefinitionHandle(fields + 1);
+    add_field("value", field(type => type.Int32()));
+
+    if (index > 0)
+    {
+        add_field("previous", field(type => type.Type(row(index - 1), true)));
+
+        for (var extra = 0; extra != 2; ++extra)
+        {
+            var target = random.Next(index);
+            add_field("member" + extra, field(type => type.Type(row(target), true)));
+        }
+    }
+
+    var next = row(Math.Min(index + 1, count - 1));
+    add_field("next", field(type => type.Pointer().Type(next, true)));
+
+    metadata.AddTypeDefinition(TypeAttributes.Public | TypeAttributes.SequentialLayout | TypeAttributes.Sealed, ns,
+        metadata.GetOrAddString("STRUCT_" + index), valueType, first, firstMethod);
+}
+
+var image = new BlobBuilder();
+new ManagedPEBuilder(PEHeaderBuilder.CreateLibraryHeader(), new MetadataRootBuilder(metadata), new BlobBuilder()).Serialize(image);
+
+using (var file = File.Create(args[1]))
+{
+    image.WriteContentTo(file);
+}
+
+return 0;
@@ -0,0 +1,517 @@
+// Benchmarks for the generator, one per command:
+//
+// cppwin32_bench format
+//     Formats a typical ABI declaration through a compile-time format_string and through a runtime format
+//     string, and counts the heap allocations each makes. The project defines CPPWIN32_COUNT_ALLOCATIONS.
+// cppwin32_bench transcode
+//     Converts string constants from UTF-16 to UTF-8 with utf16_to_utf8 and, on Windows, WideCharToMultiByte.
+// cppwin32_bench graph <Graph.winmd>
+//     Builds and walks the struct dependency graph of the first 1k, 10k and 100k structs of a file written by
+//     graph_fixture, which shows whether the walk scales linearly.
+// cppwin32_bench generate <runs> <cppwin32.exe> <arguments...>
+//     Times whole generator runs and reports the fastest. Type spelling and most other formatting costs only
+//     show up here. The generator copies base.h from its working folder, so run this from the cppwin32 folder.
+// cppwin32_bench modules <compiler> <projection folder> <units> <namespace...>
+//     Compiles <units> translation units that include the headers of the namespaces, then builds the win32
+//     module of a projection generated with -modules and compiles as many units that import it. The compiler
+//     is cl or a clang++ that supports C++20 modules. Objects go to cppwin32_bench_modules in the working folder.
+
+#include <winmd_reader.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "settings.h"
+
+namespace cppwin32
+{
+    settings_type settings;
+}
+
+#include "helpers.h"
+#include "task_group.h"
+#include "text_writer.h"
+#include "type_dependency_graph.h"
+#include "utf8.h"
+#include "allocation_count.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+namespace cppwin32_bench
+{
+    using namespace cppwin32;
+    using namespace winmd::reader;
+    using clock = std::chrono::steady_clock;
+
+    struct usage_exception {};
+
+    static double milliseconds_since(clock::time_point const start)
+    {
+        return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    }
+
+    // Runs the callback the given number of times and returns the fastest run in milliseconds.
+    static double best_of(int const runs, std::function<void()> const& callback)
+    {
+        double best{ 1e300 };
+
+        for (int run = 0; run != runs; ++run)
+        {
+            auto const start = clock::now();
+            callback();
+            best = (std::min)(best, milliseconds_since(start));
+        }
+
+        return best;
+    }
+
+    struct bench_writer : writer_base<bench_writer>
+    {
+        using writer_base<bench_writer>::write;
+    };
+
+    static void bench_format()
+    {
+        static constexpr size_t count = 1'000'000;
+        static constexpr format_string format{ R"(    % __stdcall WIN32_IMPL_%(%) noexcept;
+)" };
+
+        size_t bytes{};
+        uint64_t compiled_allocations{};
+        uint64_t runtime_allocations{};
+
+        auto const compiled = best_of(5, [&]
+            {
+                auto const first = allocations.load();
+                bench_writer w;
+
+                for (size_t i = 0; i != count; ++i)
+                {
+                    w.write<format>("int32_t", "CreateShape", "uint32_t kind, RECT* bounds");
+                }
+
+                bytes = w.flush_to_string().size();
+                compiled_allocations = allocations.load() - first;
+            });
+
+        auto const runtime = best_of(5, [&]
+            {
+                auto const first = allocations.load();
+                bench_writer w;
+
+                for (size_t i = 0; i != count; ++i)
+                {
+                    w.write("    % __stdcall WIN32_IMPL_%(%) noexcept;\n", "int32_t", "CreateShape", "uint32_t kind, RECT* bounds");
+                }
+
+                bytes = w.flush_to_string().size();
+                runtime_allocations = allocations.load() - first;
+            });
+
+        // The writer's own buffers are allocated too, so neither count is zero, but neither should grow with
+        // the number of placeholders.
+        std::printf("format: %zu declarations, %zu bytes\n", count, bytes);
+        std::printf("  format_string   %8.1f ms  %6.0f MB/s  %8llu allocations\n", compiled, bytes / compiled / 1000, static_cast<unsigned long long>(compiled_allocations));
+        std::printf("  runtime string  %8.1f ms  %6.0f MB/s  %8llu allocations\n", runtime, bytes / runtime / 1000, static_cast<unsigned long long>(runtime_allocations));
+    }
+
+    static void bench_transcode()
+    {
+        // Mostly short ASCII names and paths, as in the metadata, with some text that is not ASCII.
+        std::vector<std::u16string> constants;
+
+        for (int i = 0; i != 100'000; ++i)
+        {
+            auto text = u"Microsoft.Windows.Shape.Property." + std::u16string(static_cast<size_t>(i % 40), u'x');
+
+            if (i % 10 == 0)
+            {
+                text += u"é中\U0001f600";
+            }
+
+            constants.push_back(std::move(text));
+        }
+
+        size_t bytes{};
+
+        auto const builtin = best_of(5, [&]
+            {
+                bytes = 0;
+
+                for (auto&& text : constants)
+                {
+                    utf16_to_utf8(text, [&](std::string_view const& value) { bytes += value.size(); });
+                }
+            });
+
+        std::printf("transcode: %zu constants, %zu bytes\n", constants.size(), bytes);
+        std::printf("  utf16_to_utf8        %8.2f ms\n", builtin);
+
+#ifdef _WIN32
+        // The conversion the generator made before: measure the size, then convert into a std::string.
+        auto const system = best_of(5, [&]
+            {
+                bytes = 0;
+
+                for (auto&& text : constants)
+                {
+                    auto const source = reinterpret_cast<wchar_t const*>(text.data());
+                    auto const length = static_cast<int>(text.size());
+                    auto const size = WideCharToMultiByte(CP_UTF8, 0, source, length, nullptr, 0, nullptr, nullptr);
+                    std::string result(static_cast<size_t>(size), '?');
+                    WideCharToMultiByte(CP_UTF8, 0, source, length, result.data(), size, nullptr, nullptr);
+                    bytes += result.size();
+                }
+            });
+
+        std::printf("  WideCharToMultiByte  %8.2f ms\n", system);
+#endif
+    }
+
+    static void bench_graph(std::string const& path)
+    {
+        cache c{ std::vector<std::string>{ path } };
+        auto const members = c.namespaces().find("Graph");
+
+        if (members == c.namespaces().end() || members->second.structs.empty())
+        {
+            throw std::invalid_argument("'" + path + "' has no structs in the Graph namespace");
+        }
+
+        auto const& structs = members->second.structs;
+        std::printf("graph: %zu structs in %s\n", structs.size(), path.c_str());
+
+        for (size_t const count : { size_t{ 1'000 }, size_t{ 10'000 }, size_t{ 100'000 } })
+        {
+            if (count > structs.size())
+            {
+                break;
+            }
+
+            std::vector<TypeDef> const batch{ structs.begin(), structs.begin() + count };
+            std::vector<std::vector<TypeDef> const*> const batches{ &batch };
+            double add{};
+            double walk{};
+            size_t visited{};
+
+            for (int run = 0; run != 3; ++run)
+            {
+                type_dependency_graph graph;
+                auto start = clock::now();
+                graph.add(batches, type_dependency_graph::struct_edges{});
+                add = run ? (std::min)(add, milliseconds_since(start)) : milliseconds_since(start);
+
+                visited = 0;
+                start = clock::now();
+                graph.walk_graph([&](TypeDef const&) { ++visited; });
+                walk = run ? (std::min)(walk, milliseconds_since(start)) : milliseconds_since(start);
+            }
+
+            std::printf("  %7zu structs  add %8.2f ms  walk %8.2f ms  %7.1f ns per struct walked\n",
+                visited, add, walk, walk * 1e6 / static_cast<double>(visited));
+        }
+    }
+
+    static std::string quote(std::string const& value)
+    {
+        return "\"" + value + "\"";
+    }
+
+    static int run_command(std::string command)
+    {
+#ifdef _WIN32
+        // cmd.exe strips the first and last quote of a command that starts with one.
+        command = "\"" + command + "\"";
+#endif
+
+        return std::system(command.c_str());
+    }
+
+    static void bench_generate(int const runs, std::vector<std::string> const& command)
+    {
+        std::string line;
+
+        for (auto&& part : command)
+        {
+            line += (line.empty() ? "" : " ") + quote(part);
+        }
+
+        auto const best = best_of(runs, [&]
+            {
+                if (run_command(line) != 0)
+                {
+                    throw std::runtime_error("The generator failed: " + line);
+                }
+            });
+
+        std::printf("generate: best of %d runs %.0f ms\n", runs, best);
+    }
+
+    // The partition a module interface unit declares and the partitions it imports, read from its lines.
+    struct module_unit
+    {
+        std::filesystem::path path;
+        std::string name;
+        std::vector<std::string> imports;
+    };
+
+    static module_unit read_module_unit(std::filesystem::path const& path)
+    {
+        module_unit unit{ path };
+        std::ifstream file{ path };
+        std::string line;
+
+        while (std::getline(file, line))
+        {
+            std::string_view text{ line };
+
+            for (std::string_view const prefix : { "export import :", "import :" })
+            {
+                if (text.substr(0, prefix.size()) == prefix)
+                {
+                    auto const name = text.substr(prefix.size());
+                    unit.imports.emplace_back(name.substr(0, name.find(';')));
+                }
+            }
+
+            if (text.substr(0, 19) == "export module win32")
+            {
+                auto const name = text.substr(19, text.find(';') - 19);
+                unit.name = name.empty() ? "" : std::string{ name.substr(1) };
+            }
+        }
+
+        return unit;
+    }
+
+    // Orders the units so that every partition is built before the units that import it.
+    static std::vector<module_unit const*> sort_module_units(std::vector<module_unit> const& units)
+    {
+        std::map<std::string_view, module_unit const*> by_name;
+
+        for (auto&& unit : units)
+        {
+            by_name.emplace(unit.name, &unit);
+        }
+
+        std::vector<module_unit const*> order;
+        std::set<module_unit const*> visited;
+
+        std::function<void(module_unit const&)> visit = [&](module_unit const& unit)
+        {
+            if (!visited.insert(&unit).second)
+            {
+                return;
+            }
+
+            for (auto&& name : unit.imports)
+            {
+                auto const it = by_name.find(name);
+
+                if (it == by_name.end())
+                {
+                    throw std::invalid_argument("No module unit declares the partition :" + name);
+                }
+
+                visit(*it->second);
+            }
+
+            order.push_back(&unit);
+        };
+
+        for (auto&& unit : units)
+        {
+            visit(unit);
+        }
+
+        return order;
+    }
+
+    static void bench_modules(std::string const& compiler, std::filesystem::path const& projection, int const units, std::vector<std::string> const& namespaces)
+    {
+        auto const name = std::filesystem::path{ compiler }.stem().string();
+        bool const msvc = name == "cl";
+        auto const work = std::filesystem::absolute("cppwin32_bench_modules");
+        std::filesystem::remove_all(work);
+        std::filesystem::create_directories(work);
+
+        auto const common = msvc
+            ? quote(compiler) + " /nologo /std:c++latest /EHsc /c /I" + quote(projection.string())
+            : quote(compiler) + " -std=c++20 -c -I" + quote(projection.string());
+
+        auto compile = [&](std::string const& arguments)
+        {
+            auto const command = common + " " + arguments;
+
+            if (run_command(command) != 0)
+            {
+                throw std::runtime_error("The compiler failed: " + command);
+            }
+        };
+
+        auto write_units = [&](std::string const& prefix, std::function<void(std::ofstream&)> const& header)
+        {
+            std::vector<std::filesystem::path> paths;
+
+            for (int i = 0; i != units; ++i)
+            {
+                auto const path = work / (prefix + std::to_string(i) + ".cpp");
+                std::ofstream file{ path };
+                header(file);
+                file << "int unit_" << i << "() { return " << i << "; }\n";
+                paths.push_back(path);
+            }
+
+            return paths;
+        };
+
+        auto object = [&](std::filesystem::path const& path)
+        {
+            auto const output = (work / path.stem()).string() + (msvc ? ".obj" : ".o");
+            return msvc ? " /Fo" + quote(output) : " -o " + quote(output);
+        };
+
+        auto const header_units = write_units("header_", [&](std::ofstream& file)
+            {
+                for (auto&& ns : namespaces)
+                {
+                    file << "#include <win32/" << ns << ".h>\n";
+                }
+            });
+
+        auto const headers = best_of(1, [&]
+            {
+                for (auto&& path : header_units)
+                {
+                    compile(quote(path.string()) + object(path));
+                }
+            });
+
+        std::vector<module_unit> module_units;
+
+        for (auto&& entry : std::filesystem::directory_iterator(projection / "win32/modules"))
+        {
+            if (entry.path().extension() == ".ixx")
+            {
+                module_units.push_back(read_module_unit(entry.path()));
+            }
+        }
+
+        auto const order = sort_module_units(module_units);
+        auto const modules = work / "modules";
+        std::filesystem::create_directories(modules);
+
+        auto const interfaces = best_of(1, [&]
+            {
+                for (auto&& unit : order)
+                {
+                    auto const module_name = unit->name.empty() ? std::string{ "win32" } : "win32-" + unit->name;
+                    auto const path = unit->path.string();
+
+                    if (msvc)
+                    {
+                        compile("/interface /TP /ifcSearchDir " + quote(modules.string()) + " /ifcOutput " + quote((modules / (module_name + ".ifc")).string())
+                            + " " + quote(path) + object(modules / module_name));
+                    }
+                    else
+                    {
+                        compile("-x c++-module --precompile -fprebuilt-module-path=" + quote(modules.string())
+                            + " " + quote(path) + " -o " + quote((modules / (module_name + ".pcm")).string()));
+                    }
+                }
+            });
+
+        auto const import_units = write_units("import_", [&](std::ofstream& file)
+            {
+                file << "import win32;\n";
+            });
+
+        auto const imports = best_of(1, [&]
+            {
+                for (auto&& path : import_units)
+                {
+                    auto const search = msvc ? "/ifcSearchDir " + quote(modules.string()) : "-fprebuilt-module-path=" + quote(modules.string());
+                    compile(search + " " + quote(path.string()) + object(path));
+                }
+            });
+
+        std::printf("modules: %d units including or importing %zu namespaces with %s\n", units, namespaces.size(), name.c_str());
+        std::printf("  #include            %10.0f ms  %8.0f ms per unit\n", headers, headers / units);
+        std::printf("  module interfaces   %10.0f ms  (%zu units, once)\n", interfaces, order.size());
+        std::printf("  import              %10.0f ms  %8.0f ms per unit\n", imports, imports / units);
+        std::printf("  import total        %10.0f ms\n", interfaces + imports);
+    }
+
+    static int run(int const argc, char* argv[])
+    {
+        try
+        {
+            std::vector<std::string> const args{ argv + (std::min)(argc, 1), argv + argc };
+
+            if (args.empty())
+            {
+                throw usage_exception{};
+            }
+
+            auto const& command = args[0];
+
+            if (command == "format" && args.size() == 1)
+            {
+                bench_format();
+            }
+            else if (command == "transcode" && args.size() == 1)
+            {
+                bench_transcode();
+            }
+            else if (command == "graph" && args.size() == 2)
+            {
+                bench_graph(args[1]);
+            }
+            else if (command == "generate" && args.size() >= 3)
+            {
+                bench_generate((std::max)(1, std::atoi(args[1].c_str())), { args.begin() + 2, args.end() });
+            }
+            else if (command == "modules" && args.size() >= 5)
+            {
+                bench_modules(args[1], args[2], (std::max)(1, std::atoi(args[3].c_str())), { args.begin() + 4, args.end() });
+            }
+            else
+            {
+                throw usage_exception{};
+            }
+        }
+        catch (usage_exception const&)
+        {
+            std::printf(R"(cppwin32_bench format
+cppwin32_bench transcode
+cppwin32_bench graph <Graph.winmd>
+cppwin32_bench generate <runs> <cppwin32.exe> <arguments...>
+cppwin32_bench modules <compiler> <projection folder> <units> <namespace...>
+)");
+            return 2;
+        }
+        catch (std::exception const& e)
+        {
+            std::printf("cppwin32_bench : error %s\n", e.what());
+            return 1;
+        }
+
+        return 0;
+    }
+}
+
+int main(int const argc, char* argv[])
+{
+    return cppwin32_bench::run(argc, argv);
+}
@@ -0,0 +1,9 @@
+// Two delegates that take each other as parameters. A delegate is an alias that cannot be forward
+// declared, so the generator has to reject this cycle rather than emit headers that do not compile.
+
+namespace Windows.Win32.Synthetic.Cycle
+{
+    public delegate void FIRST_CALLBACK(SECOND_CALLBACK second);
+
+    public delegate void SECOND_CALLBACK(FIRST_CALLBACK first);
+}
@@ -0,0 +1,168 @@
+// A small stand-in for Windows.Win32.winmd that covers what the generator has to order and group: nested
+// types, pointer cycles between them, unions, flags, interface inheritance, delegates, functions from more
+// than one DLL and two namespaces whose structs depend on each other.
+
+using System;
+using System.Runtime.InteropServices;
+using Windows.Win32.Interop;
+
+namespace Windows.Win32.Synthetic.Core
+{
+    public enum SHAPE_KIND : int
+    {
+        SHAPE_NONE = 0,
+        SHAPE_RECT = 1,
+        SHAPE_TREE = 2,
+    }
+
+    [Flags]
+    public enum SHAPE_FLAGS : uint
+    {
+        SHAPE_FLAG_NONE = 0,
+        SHAPE_FLAG_VISIBLE = 1,
+        SHAPE_FLAG_SELECTED = 2,
+    }
+
+    [NativeTypedef]
+    public struct HSHAPE
+    {
+        public IntPtr Value;
+    }
+
+    public struct POINT
+    {
+        public int x;
+        public int y;
+    }
+
+    public struct RECT
+    {
+        public POINT top_left;
+        public POINT bottom_right;
+    }
+
+    [StructLayout(LayoutKind.Explicit)]
+    public struct SHAPE_VALUE
+    {
+        [FieldOffset(0)] public RECT rect;
+        [FieldOffset(0)] public POINT point;
+        [FieldOffset(0)] public ulong bits;
+    }
+
+    // Holds a Graphics struct by value while Graphics.BRUSH_INFO holds a Core struct, so the two
+    // namespaces share their struct headers.
+    public struct SHAPE_STYLE
+    {
+        public Windows.Win32.Synthetic.Graphics.BRUSH brush;
+        public SHAPE_FLAGS flags;
+    }
+
+    // The nested types point at each other, which only a forward declaration can resolve.
+    public unsafe struct TREE
+    {
+        public _Node root;
+        public uint count;
+
+        public struct _Node
+        {
+            public _Node* first_child;
+            public _Node* next_sibling;
+            public _Leaf* leaf;
+        }
+
+        public struct _Leaf
+        {
+            public _Node* parent;
+            public SHAPE_VALUE value;
+        }
+    }
+
+    [UnmanagedFunctionPointer(CallingConvention.Winapi)]
+    public unsafe delegate int SHAPE_CALLBACK(HSHAPE shape, RECT* bounds, IntPtr context);
+
+    [Guid("5f4a1c6e-2b3d-4e8f-9a01-23456789abcd")]
+    [InterfaceType(ComInterfaceType.InterfaceIsIUnknown)]
+    [ComImport]
+    public unsafe interface IShape
+    {
+        [PreserveSig]
+        int GetKind(SHAPE_KIND* kind);
+
+        [PreserveSig]
+        int GetBounds(RECT* bounds);
+    }
+
+    [Guid("6a5b2d7f-3c4e-4f90-8b12-3456789abcde")]
+    [InterfaceType(ComInterfaceType.InterfaceIsIUnknown)]
+    [ComImport]
+    public unsafe interface ITreeShape : IShape
+    {
+        [PreserveSig]
+        int GetTree(TREE* tree);
+
+        [PreserveSig]
+        int Visit(SHAPE_CALLBACK callback, IntPtr context);
+    }
+
+    public static unsafe class Apis
+    {
+        public const uint SHAPE_MAX_DEPTH = 16u;
+        public const int SHAPE_ERROR_INVALID = -1;
+        public const double SHAPE_SCALE = 0.5;
+
+        [DllImport("SHAPES.dll", ExactSpelling = true)]
+        public static extern HSHAPE CreateShape(SHAPE_KIND kind, RECT* bounds);
+
+        [DllImport("SHAPES.dll", ExactSpelling = true)]
+        public static extern int DestroyShape(HSHAPE shape);
+
+        [DllImport("SHAPES.dll", ExactSpelling = true)]
+        public static extern int WalkShapes(TREE* tree, SHAPE_CALLBACK callback, IntPtr context);
+
+        [DllImport("api-ms-win-shapes-l1-1-0.dll", ExactSpelling = true)]
+        public static extern SHAPE_FLAGS GetShapeFlags(HSHAPE shape);
+
+        [DllImport("api-ms-win-shapes-l1-1-0.dll", ExactSpelling = true)]
+        public static extern void SetShapeStyle(HSHAPE shape, SHAPE_STYLE* style);
+    }
+}
+
+namespace Windows.Win32.Synthetic.Graphics
+{
+    public struct COLOR
+    {
+        public byte r;
+        public byte g;
+        public byte b;
+        public byte a;
+    }
+
+    public struct BRUSH
+    {
+        public COLOR color;
+        public float opacity;
+    }
+
+    public struct BRUSH_INFO
+    {
+        public BRUSH brush;
+        public Windows.Win32.Synthetic.Core.RECT bounds;
+    }
+
+    [Guid("7b6c3e80-4d5f-4a01-9c23-456789abcdef")]
+    [InterfaceType(ComInterfaceType.InterfaceIsIUnknown)]
+    [ComImport]
+    public unsafe interface IBrushShape : Windows.Win32.Synthetic.Core.IShape
+    {
+        [PreserveSig]
+        int GetBrush(BRUSH_INFO* info);
+    }
+
+    public static unsafe class Apis
+    {
+        public const uint BRUSH_OPAQUE = 255u;
+
+        [DllImport("GRAPHICS.dll", ExactSpelling = true)]
+        public static extern int FillShape(Windows.Win32.Synthetic.Core.HSHAPE shape, BRUSH* brush);
+    }
+}
@@ -0,0 +1,211 @@
+// Runs cppwin32.exe over the fixtures in the fixture folder and checks that:
+//
+// - a serial run (-jobs 1) and several parallel runs write byte-identical trees, with and without modules
+//   and per-DLL fragments, and a second parallel run over existing output leaves it unchanged;
+// - a delegate cycle, which no forward declaration can break, fails the run and names the cycle.
+//
+// cppwin32_test.exe <cppwin32.exe> <cppwin32 source folder> <fixture folder> <work folder>
+//
+// The generator copies base.h from its working folder, so it is run from the cppwin32 source folder.
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <string_view>
+
+namespace cppwin32_test
+{
+    using std::filesystem::path;
+
+    struct options
+    {
+        path generator;
+        path source;
+        path fixture;
+        path work;
+    };
+
+    static int failures{};
+
+    static void fail(std::string const& message)
+    {
+        std::printf("FAILED: %s\n", message.c_str());
+        ++failures;
+    }
+
+    static std::string read_file(path const& filename)
+    {
+        std::ifstream file{ filename, std::ios::in | std::ios::binary };
+        return { std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+    }
+
+    // Every file under the folder, keyed by its path relative to the folder with forward slashes.
+    static std::map<std::string, std::string> read_tree(path const& folder)
+    {
+        std::map<std::string, std::string> files;
+
+        for (auto&& entry : std::filesystem::recursive_directory_iterator(folder))
+        {
+            if (entry.is_regular_file())
+            {
+                files.emplace(entry.path().lexically_relative(folder).generic_string(), read_file(entry.path()));
+            }
+        }
+
+        return files;
+    }
+
+    // Runs the generator with its output and errors redirected to <output>.log and returns its exit code.
+    static int run_generator(options const& options, std::string const& arguments, path const& output, std::string& log)
+    {
+        auto const log_path = path{ output }.concat(".log");
+        std::filesystem::create_directories(output.parent_path());
+
+        auto command = "\"" + options.generator.string() + "\" " + arguments
+            + " -output \"" + output.string() + "\" > \"" + log_path.string() + "\" 2>&1";
+
+#ifdef _WIN32
+        // cmd.exe strips the first and last quote of a command that starts with one.
+        command = "\"" + command + "\"";
+#endif
+
+        auto const result = std::system(command.c_str());
+        log = read_file(log_path);
+        return result;
+    }
+
+    static bool generate(options const& options, std::string const& arguments, path const& output)
+    {
+        std::string log;
+
+        if (run_generator(options, arguments, output, log) != 0)
+        {
+            fail("cppwin32 " + arguments + " failed:\n" + log);
+            return false;
+        }
+
+        return true;
+    }
+
+    static void compare_trees(std::map<std::string, std::string> const& expected, path const& folder, std::string const& name)
+    {
+        auto const actual = read_tree(folder);
+
+        for (auto&& [filename, content] : expected)
+        {
+            auto it = actual.find(filename);
+
+            if (it == actual.end())
+            {
+                fail(name + " is missing " + filename);
+            }
+            else if (it->second != content)
+            {
+                fail(name + " differs in " + filename);
+            }
+        }
+
+        for (auto&& [filename, content] : actual)
+        {
+            if (expected.find(filename) == expected.end())
+            {
+                fail(name + " has an extra file " + filename);
+            }
+        }
+    }
+
+    static void test_deterministic(options const& options, std::string const& name, std::string const& arguments)
+    {
+        std::printf("deterministic %s\n", name.c_str());
+
+        auto const folder = options.work / name;
+        std::filesystem::remove_all(folder);
+
+        if (!generate(options, arguments + " -jobs 1", folder / "serial"))
+        {
+            return;
+        }
+
+        auto const expected = read_tree(folder / "serial");
+
+        if (expected.empty())
+        {
+            fail("cppwin32 " + arguments + " wrote nothing");
+            return;
+        }
+
+        // Parallel schedules differ from run to run, so a single parallel run would prove little.
+        for (int run = 0; run != 4; ++run)
+        {
+            auto const output = folder / ("parallel" + std::to_string(run));
+
+            if (generate(options, arguments, output))
+            {
+                compare_trees(expected, output, name + " parallel run " + std::to_string(run));
+            }
+        }
+
+        auto const output = folder / "parallel0";
+
+        if (generate(options, arguments, output))
+        {
+            compare_trees(expected, output, name + " incremental run");
+        }
+    }
+
+    static void test_cycle(options const& options)
+    {
+        std::printf("cycle\n");
+
+        auto const folder = options.work / "cycle";
+        std::filesystem::remove_all(folder);
+
+        std::string log;
+        auto const arguments = "-input \"" + (options.fixture / "Cycle.winmd").string() + "\"";
+
+        if (run_generator(options, arguments, folder, log) == 0)
+        {
+            fail("cppwin32 accepted a delegate cycle");
+        }
+
+        for (std::string_view const expected : { "Cyclic dependency graph encountered", "FIRST_CALLBACK", "SECOND_CALLBACK" })
+        {
+            if (log.find(expected) == std::string::npos)
+            {
+                fail("the cycle error does not mention " + std::string{ expected } + ":\n" + log);
+            }
+        }
+    }
+
+    static int run(int const argc, char* argv[])
+    {
+        if (argc != 5)
+        {
+            std::printf("cppwin32_test.exe <cppwin32.exe> <cppwin32 source folder> <fixture folder> <work folder>\n");
+            return 2;
+        }
+
+        options options{ std::filesystem::absolute(argv[1]), std::filesystem::absolute(argv[2]), std::filesystem::absolute(argv[3]), std::filesystem::absolute(argv[4]) };
+        std::filesystem::create_directories(options.work);
+        std::filesystem::current_path(options.source);
+
+        auto const inputs = "-input \"" + (options.fixture / "Synthetic.winmd").string()
+            + "\" -reference \"" + (options.fixture / "../../Windows.Win32.Interop.dll").lexically_normal().string() + "\"";
+
+        test_deterministic(options, "default", inputs);
+        test_deterministic(options, "modules", inputs + " -modules -fragments 1");
+        test_cycle(options);
+
+        std::printf(failures ? "%d failed\n" : "passed\n", failures);
+        return failures ? 1 : 0;
+    }
+}
+
+int main(int const argc, char* argv[])
+{
+    return cppwin32_test::run(argc, argv);
+}